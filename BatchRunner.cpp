@@ -0,0 +1,153 @@
+//
+// Runs many headless ROM jobs at once, one Chip8 per job, spread over all cores.
+//
+
+#include "BatchRunner.h"
+#include "Chip8.h"
+#include "Chip8Pool.h"
+#include "InputScript.h"
+#include "QuirksDatabase.h"
+#include "RomLibrary.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+
+bool LoadBatchJobs(char const* filename, std::vector<BatchJob>& jobs) {
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        BatchJob job;
+
+        if (!(fields >> job.rom >> job.script >> job.cycles)) {
+            return false;
+        }
+
+        if (job.script == "-") {
+            job.script.clear();
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+static BatchResult RunJob(BatchJob const& job, RomLibrary const& library, Quirks quirks,
+                          uint64_t instructionsPerSecond, Chip8Pool& instances) {
+    BatchResult result{};
+
+    InputScript script;
+
+    if (!job.script.empty() && !script.Load(job.script.c_str())) {
+        result.error = "could not read input script " + job.script;
+        return result;
+    }
+
+    // Lookups only read the library, so every worker can share it
+    RomSpan rom;
+
+    if (!library.Find(job.rom, rom)) {
+        result.error = "could not open ROM " + job.rom;
+        return result;
+    }
+
+    // Chip8 is over 6KB (and XO-CHIP's memory comes on top, on the heap), too big to be
+    // comfortable on a worker's stack, so jobs share a pool of them instead
+    std::unique_ptr<Chip8> chip8 = instances.Acquire();
+
+    // A pooled instance still has the last job's profile, and the profile decides how much
+    // memory there is and which fonts go in, so a different one means resetting again to
+    // start from where a new instance would
+    if (chip8->GetQuirks() != quirks) {
+        chip8->SetQuirks(quirks);
+        chip8->Reset();
+    }
+
+    if (!chip8->LoadROM(rom.data, rom.size)) {
+        instances.Release(std::move(chip8));
+        result.error = "ROM too large " + job.rom;
+        return result;
+    }
+
+    if (script.seeded) {
+        chip8->Seed(script.seed);
+    }
+
+    if (script.instructionsPerSecond) {
+        instructionsPerSecond = script.instructionsPerSecond;
+    }
+
+    uint64_t cycles = job.cycles ? job.cycles : script.end;
+
+    result.executed = RunScripted(*chip8, script, cycles, instructionsPerSecond);
+    result.skipped = chip8->idleCycles;
+    result.videoHash = chip8->VideoHash();
+    result.ok = true;
+
+    instances.Release(std::move(chip8));
+
+    return result;
+}
+
+std::vector<BatchResult> RunBatch(std::vector<BatchJob> const& jobs, unsigned int threadCount,
+                                  uint64_t instructionsPerSecond, Quirks quirks,
+                                  QuirksDatabase const* database) {
+    // Every job writes only its own slot, so the results need no locking
+    std::vector<BatchResult> results(jobs.size());
+
+    // Map (and look up) each distinct ROM once, however many jobs use it, by the path the
+    // jobs give. A ROM that can't be opened is left out of the library so its jobs report
+    // the error.
+    RomLibrary library;
+    std::unordered_map<std::string, Quirks> profiles;
+
+    for (BatchJob const& job : jobs) {
+        if (profiles.count(job.rom)) {
+            continue;
+        }
+
+        Quirks profile = quirks;
+        RomSpan rom{};
+
+        if (library.Add(job.rom, job.rom.c_str()) && database) {
+            library.Find(job.rom, rom);
+            database->Find(rom, profile);
+        }
+
+        profiles[job.rom] = profile;
+    }
+
+    // At most one instance per worker ever gets allocated
+    Chip8Pool instances;
+    ThreadPool pool(threadCount);
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Quirks profile = profiles[jobs[i].rom];
+
+        pool.Submit([&jobs, &results, &library, &instances, i, profile, instructionsPerSecond] {
+            // Timed here, so a job that fails part way still says how long it took
+            auto startTime = std::chrono::steady_clock::now();
+
+            results[i] = RunJob(jobs[i], library, profile, instructionsPerSecond, instances);
+            results[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        });
+    }
+
+    pool.Wait();
+
+    return results;
+}
@@ -0,0 +1,55 @@
+//
+// Runs many headless ROM jobs at once, one Chip8 per job, spread over all cores.
+//
+
+#include "Chip8.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_BATCHRUNNER_H
+#define EMULATOR_CHIP_8_BATCHRUNNER_H
+
+
+// BATCH JOB
+/* One ROM to run for a fixed number of instructions, with an optional input script (an
+ * empty path means no input at all). A job file lists one job per line:
+ *
+ *     <ROM> <InputScript or -> <Cycles>
+ *
+ * Blank lines and lines starting with # are ignored. A script's seed and speed, if
+ * it has them, take precedence over the batch's, and 0 cycles runs a recorded script to
+ * its end.
+ */
+struct BatchJob {
+    std::string rom;
+    std::string script;
+    uint64_t cycles;
+};
+
+/* executed is every instruction the job was given time for, skipped the part of that
+ * spent in idle loops or waiting for a key and counted without being run (see
+ * Chip8::idleCycles). seconds is how long the job took, whether or not it ran.
+ */
+struct BatchResult {
+    bool ok;
+    std::string error;
+    uint64_t executed;
+    uint64_t skipped;
+    uint64_t videoHash;
+    double seconds;
+};
+
+bool LoadBatchJobs(char const* filename, std::vector<BatchJob>& jobs);
+
+class QuirksDatabase;
+
+// Runs every job on a pool of threadCount workers and returns the results in job order.
+// Each ROM is looked up in the quirks database, if there is one, and runs with quirks
+// when it isn't there.
+std::vector<BatchResult> RunBatch(std::vector<BatchJob> const& jobs, unsigned int threadCount,
+                                  uint64_t instructionsPerSecond, Quirks quirks = Quirks::Modern,
+                                  QuirksDatabase const* database = nullptr);
+
+
+#endif //EMULATOR_CHIP_8_BATCHRUNNER_H
@@ -0,0 +1,80 @@
+//
+// Turns the sound timer (and XO-CHIP's audio pattern) into samples for the audio device.
+//
+
+#include "Beeper.h"
+#include <cmath>
+
+// Four bits on, four off: at 4000 bits a second that's a 500Hz square wave
+static const uint8_t SQUARE_PATTERN[16] = {
+        0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+        0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0
+};
+
+Beeper::Beeper(unsigned int sampleRate, unsigned int framesPerSecond)
+    : sampleRate(sampleRate),
+      samplesPerFrame((sampleRate + framesPerSecond - 1) / framesPerSecond),
+      targetDepth(samplesPerFrame > AUDIO_DEVICE_SAMPLES ? (samplesPerFrame - AUDIO_DEVICE_SAMPLES) / 2 : 0) {
+}
+
+void Beeper::Fill(Chip8 const& chip8, AudioRing& ring) {
+    size_t queued = ring.Size();
+    unsigned int count = samplesPerFrame;
+
+    // The ring is ahead of the device, so as much of this frame's sound as it is over the
+    // target goes, rather than the latency growing
+    if (queued > targetDepth) {
+        size_t excess = queued - targetDepth;
+
+        count = excess < samplesPerFrame ? samplesPerFrame - static_cast<unsigned int>(excess) : 0;
+        droppedSamples += samplesPerFrame - count;
+    }
+
+    if (!chip8.soundTimer) {
+        // The next tone starts at the beginning of its pattern
+        position = 0.0;
+
+        for (unsigned int i = 0; i < count; ++i) {
+            if (!ring.Push(0)) {
+                droppedSamples += count - i;
+                break;
+            }
+        }
+
+        return;
+    }
+
+    uint8_t const* pattern = SQUARE_PATTERN;
+    double bitsPerSecond = 4000.0;
+
+    if (chip8.GetQuirks() == Quirks::XoChip) {
+        bool silent = true;
+
+        for (uint8_t byte : chip8.audioPattern) {
+            silent = silent && !byte;
+        }
+
+        if (!silent) {
+            pattern = chip8.audioPattern;
+            bitsPerSecond = 4000.0 * std::pow(2.0, (chip8.pitch - 64) / 48.0);
+        }
+    }
+
+    double step = bitsPerSecond / sampleRate;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        unsigned int bit = static_cast<unsigned int>(position);
+        bool on = (pattern[bit >> 3u] >> (7u - (bit & 0x7u))) & 0x1u;
+
+        if (!ring.Push(on ? volume : static_cast<int16_t>(-volume))) {
+            droppedSamples += count - i;
+            break;
+        }
+
+        position += step;
+
+        if (position >= PATTERN_BITS) {
+            position -= PATTERN_BITS;
+        }
+    }
+}
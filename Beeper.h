@@ -0,0 +1,75 @@
+//
+// Turns the sound timer (and XO-CHIP's audio pattern) into samples for the audio device.
+//
+
+#include "Chip8.h"
+#include "SpscQueue.h"
+#include <cstddef>
+#include <cstdint>
+
+#ifndef EMULATOR_CHIP_8_BEEPER_H
+#define EMULATOR_CHIP_8_BEEPER_H
+
+
+const unsigned int AUDIO_SAMPLE_RATE = 48000;
+
+// What the device asks for at a time, about 5ms
+const unsigned int AUDIO_DEVICE_SAMPLES = 256;
+
+// Room for a frame's samples at 60 frames a second on top of the Beeper's target, and a
+// power of two
+const size_t AUDIO_RING_SIZE = 2048;
+
+// Samples from the emulation thread to the audio device's callback
+using AudioRing = SpscQueue<int16_t, AUDIO_RING_SIZE>;
+
+
+// BEEPER
+/* The samples are made on the emulation side, once a frame, right after the timers have
+ * ticked, so the audio callback has nothing to do but copy them out of the ring; it never
+ * locks, allocates or looks at the Chip8. Whatever the callback finds missing it plays as
+ * silence.
+ *
+ * Each frame adds one frame's worth of samples. What's still queued from earlier frames
+ * when they go in is kept to the target depth, chosen so that it plus a device period
+ * stays under a frame: however the emulation and audio clocks drift apart, a frame's
+ * sound starts playing less than a frame after it ran. When the ring is further ahead
+ * than that, the part of this frame's sound over the target is dropped. A frame that comes
+ * late isn't covered by queueing more ahead; the callback plays silence until it arrives.
+ *
+ * The sound is a 1-bit pattern of 128 bits played at 4000 bits a second, like XO-CHIP's:
+ * while the sound timer is nonzero the pattern set with OP_Fx02 plays at the rate set by
+ * OP_Fx3A, and every other program (or an XO-CHIP one that never set a pattern) gets a
+ * 500Hz square wave. The position in the pattern carries over from frame to frame, so a
+ * tone that goes on across frames doesn't click at the seams.
+ */
+class Beeper {
+public:
+    explicit Beeper(unsigned int sampleRate = AUDIO_SAMPLE_RATE, unsigned int framesPerSecond = 60);
+
+    // Called once a frame with the machine as it is after the frame ran
+    void Fill(Chip8 const& chip8, AudioRing& ring);
+
+    void SetVolume(int16_t volume) { this->volume = volume; }
+
+    // Samples of sound dropped because the ring was ahead of the device
+    uint64_t DroppedSamples() const { return droppedSamples; }
+
+private:
+    static const unsigned int PATTERN_BITS = 128;
+
+    unsigned int sampleRate;
+    unsigned int samplesPerFrame;
+
+    // The most samples left queued from earlier frames when a frame's samples go in
+    unsigned int targetDepth;
+
+    // Position in the pattern in bits, kept below PATTERN_BITS
+    double position = 0.0;
+
+    int16_t volume = 4000;
+    uint64_t droppedSamples = 0;
+};
+
+
+#endif //EMULATOR_CHIP_8_BEEPER_H
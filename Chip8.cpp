@@ -3,116 +3,547 @@
 //
 
 #include "Chip8.h"
-#include <fstream>
+#include "RomLibrary.h"
+#include <cstring>
+#include <initializer_list>
+
+
+
+const unsigned int DECODED_SIZE = MEMORY_SIZE - START_ADDRESS;
+
+// Calls f with a value of the policy type for a run-time profile, for the places that have
+// to go from one to the other
+template <typename F>
+static auto WithQuirks(Quirks quirks, F&& f) {
+    switch (quirks) {
+        case Quirks::Cosmac:
+            return f(CosmacQuirks{});
+        case Quirks::SuperChip:
+            return f(SuperChipQuirks{});
+        case Quirks::XoChip:
+            return f(XoChipQuirks{});
+        case Quirks::Modern:
+        default:
+            return f(ModernQuirks{});
+    }
+}
+
+// FUNCTION POINTER TABLES
+/* The tables are the same for every Chip8, so there is one copy of each, built by the
+ * compiler: MakeTable() fills every slot with OP_NULL and then sets the listed ones, and
+ * since it runs at compile time the tables are plain constant data with nothing to do at
+ * startup or per instance. Each quirks profile has its own set, and a Chip8 only keeps a
+ * pointer to the one it runs with.
+ */
+struct TableEntry {
+    unsigned int index;
+    Chip8::Chip8Func handler;
+};
+
+template <size_t Size>
+static constexpr std::array<Chip8::Chip8Func, Size> MakeTable(std::initializer_list<TableEntry> entries) {
+    std::array<Chip8::Chip8Func, Size> table{};
+
+    for (size_t i = 0; i < Size; ++i) {
+        table[i] = &Chip8::OP_NULL;
+    }
 
+    for (TableEntry const& entry : entries) {
+        table[entry.index] = entry.handler;
+    }
 
-const unsigned int START_ADDRESS = 0x200;
-const unsigned int FONTSET_START_ADDRESS = 0x50;
+    return table;
+}
+
+// Every profile's tables are the same apart from the handlers its quirks change
+template <typename QuirksPolicy>
+static constexpr Chip8::DispatchTables MakeTables() {
+    Chip8::DispatchTables tables{};
+
+    tables.table = MakeTable<0xF + 1>({
+            {0x0, &Chip8::Table0},
+            {0x1, &Chip8::OP_1nnn},
+            {0x2, &Chip8::OP_2nnn},
+            {0x3, &Chip8::OP_3xkk<QuirksPolicy>},
+            {0x4, &Chip8::OP_4xkk<QuirksPolicy>},
+            {0x5, QuirksPolicy::xoChip ? &Chip8::Table5 : &Chip8::OP_5xy0<QuirksPolicy>},
+            {0x6, &Chip8::OP_6xkk},
+            {0x7, &Chip8::OP_7xkk},
+            {0x8, &Chip8::Table8},
+            {0x9, &Chip8::OP_9xy0<QuirksPolicy>},
+            {0xA, &Chip8::OP_Annn},
+            {0xB, &Chip8::OP_Bnnn<QuirksPolicy>},
+            {0xC, &Chip8::OP_Cxkk},
+            {0xD, &Chip8::OP_Dxyn<QuirksPolicy>},
+            {0xE, &Chip8::TableE},
+            {0xF, &Chip8::TableF},
+    });
+
+    /* The 0 family is decoded on its low byte, which SUPER-CHIP needs to tell 00EE from
+     * 00FE. The other profiles look at the low nibble only, as they always have.
+     */
+    tables.table0 = MakeTable<0xFF + 1>({});
+
+    if constexpr (QuirksPolicy::superChip) {
+        tables.table0[0xE0] = &Chip8::OP_00E0<QuirksPolicy>;
+        tables.table0[0xEE] = &Chip8::OP_00EE;
+        tables.table0[0xFB] = &Chip8::OP_00FB;
+        tables.table0[0xFC] = &Chip8::OP_00FC;
+        tables.table0[0xFD] = &Chip8::OP_00FD;
+        tables.table0[0xFE] = &Chip8::OP_00FE;
+        tables.table0[0xFF] = &Chip8::OP_00FF;
+
+        for (unsigned int n = 0; n <= 0xF; ++n) {
+            tables.table0[0xC0 + n] = &Chip8::OP_00Cn;
+
+            if constexpr (QuirksPolicy::xoChip) {
+                tables.table0[0xD0 + n] = &Chip8::OP_00Dn;
+            }
+        }
+    } else {
+        for (unsigned int high = 0; high <= 0xF; ++high) {
+            tables.table0[high << 4u] = &Chip8::OP_00E0<QuirksPolicy>;
+            tables.table0[(high << 4u) | 0xEu] = &Chip8::OP_00EE;
+        }
+    }
+
+    // Only XO-CHIP has more than one instruction in the 5 family
+    if constexpr (QuirksPolicy::xoChip) {
+        tables.table5 = MakeTable<0xF + 1>({
+                {0x0, &Chip8::OP_5xy0<QuirksPolicy>},
+                {0x2, &Chip8::OP_5xy2},
+                {0x3, &Chip8::OP_5xy3},
+        });
+    } else {
+        for (Chip8::Chip8Func& handler : tables.table5) {
+            handler = &Chip8::OP_5xy0<QuirksPolicy>;
+        }
+    }
+
+    tables.table8 = MakeTable<0xF + 1>({
+            {0x0, &Chip8::OP_8xy0},
+            {0x1, &Chip8::OP_8xy1},
+            {0x2, &Chip8::OP_8xy2},
+            {0x3, &Chip8::OP_8xy3},
+            {0x4, &Chip8::OP_8xy4},
+            {0x5, &Chip8::OP_8xy5},
+            {0x6, &Chip8::OP_8xy6<QuirksPolicy>},
+            {0x7, &Chip8::OP_8xy7},
+            {0xE, &Chip8::OP_8xyE<QuirksPolicy>},
+    });
+
+    tables.tableE = MakeTable<0xF + 1>({
+            {0x1, &Chip8::OP_ExA1<QuirksPolicy>},
+            {0xE, &Chip8::OP_Ex9E<QuirksPolicy>},
+    });
+
+    tables.tableF = MakeTable<0xFF + 1>({
+            {0x07, &Chip8::OP_Fx07},
+            {0x0A, &Chip8::OP_Fx0A},
+            {0x15, &Chip8::OP_Fx15},
+            {0x18, &Chip8::OP_Fx18},
+            {0x1E, &Chip8::OP_Fx1E},
+            {0x29, &Chip8::OP_Fx29},
+            {0x33, &Chip8::OP_Fx33},
+            {0x55, &Chip8::OP_Fx55<QuirksPolicy>},
+            {0x65, &Chip8::OP_Fx65<QuirksPolicy>},
+    });
+
+    if constexpr (QuirksPolicy::superChip) {
+        tables.tableF[0x30] = &Chip8::OP_Fx30;
+        tables.tableF[0x75] = &Chip8::OP_Fx75;
+        tables.tableF[0x85] = &Chip8::OP_Fx85;
+    }
+
+    if constexpr (QuirksPolicy::xoChip) {
+        tables.tableF[0x00] = &Chip8::OP_F000;
+        tables.tableF[0x01] = &Chip8::OP_Fn01;
+        tables.tableF[0x02] = &Chip8::OP_Fx02;
+        tables.tableF[0x3A] = &Chip8::OP_Fx3A;
+    }
+
+    return tables;
+}
+
+constexpr Chip8::DispatchTables Chip8::dispatchTables[4] = {
+        MakeTables<ModernQuirks>(),
+        MakeTables<CosmacQuirks>(),
+        MakeTables<SuperChipQuirks>(),
+        MakeTables<XoChipQuirks>(),
+};
+
+Chip8::Chip8(Dispatch dispatch, Quirks quirks)
+    : dispatch(dispatch) {
+    SetQuirks(quirks);
+    Reset();
+}
+
+void Chip8::SetQuirks(Quirks newQuirks) {
+    quirks = newQuirks;
+    tables = &dispatchTables[static_cast<unsigned int>(quirks)];
+
+    // Memory moves between the inline 4KB and XO-CHIP's 64KB, bringing the first 4KB along
+    if (quirks == Quirks::XoChip && !extendedMemory) {
+        extendedMemory.reset(new uint8_t[EXTENDED_MEMORY_SIZE]());
+        memcpy(extendedMemory.get(), classicMemory, MEMORY_SIZE);
+        memory = extendedMemory.get();
+        addressMask = EXTENDED_MEMORY_SIZE - 1;
+    } else if (quirks != Quirks::XoChip && extendedMemory) {
+        memcpy(classicMemory, extendedMemory.get(), MEMORY_SIZE);
+        extendedMemory.reset();
+        memory = classicMemory;
+        addressMask = MEMORY_SIZE - 1;
+    }
+
+    // The big font lives in the interpreter's part of memory, where no ROM goes
+    if (Extended()) {
+        memcpy(memory + BIG_FONTSET_START_ADDRESS, bigFontset, BIG_FONTSET_SIZE);
+    }
+
+    // Whatever was decoded or compiled so far points at the old profile's handlers
+    InvalidateDecoded(START_ADDRESS, DECODED_SIZE);
+}
+
+void Chip8::Reset() {
+    // Registers, stack, timers, keypad and all, in one go
+    static_cast<Chip8Cpu&>(*this) = Chip8Cpu();
+    idleCycles = 0;
+    spritesDrawn = 0;
+    memset(familyCounts, 0, sizeof(familyCounts));
+
+    // Only as much memory as the profile uses, so pooled classic machines stay cheap to reset
+    memset(memory, 0, MemorySize());
+    memset(video, 0, sizeof(video));
+    dirtyRows = 0xFFFFFFFFu;
+
+    memset(extendedVideo, 0, sizeof(extendedVideo));
+    hires = false;
+    planeMask = 0x1;
+    memset(flags, 0, sizeof(flags));
+    memset(audioPattern, 0, sizeof(audioPattern));
+    pitch = 64;
 
-Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().count)) {
     // Initialize PC
     pc = START_ADDRESS;
 
     // Load fonts into memory
-    for (unsigned int i = 0; i < FONTSET_SIZE; ++i) {
-        memory[FONTSET_START_ADDRESS + i] = fontset[i];
+    memcpy(memory + FONTSET_START_ADDRESS, fontset, FONTSET_SIZE);
+
+    if (Extended()) {
+        memcpy(memory + BIG_FONTSET_START_ADDRESS, bigFontset, BIG_FONTSET_SIZE);
     }
 
     // Initialize RNG
-    randByte = std::uniform_int_distribution<uint8_t>(0,255U);
-
-    // Set up function pointer table
-    table[0x0] = &Chip8::Table0;
-    table[0x1] = &Chip8::OP_1nnn;
-    table[0x2] = &Chip8::OP_2nnn;
-    table[0x3] = &Chip8::OP_3xkk;
-    table[0x4] = &Chip8::OP_4xkk;
-    table[0x5] = &Chip8::OP_5xy0;
-    table[0x6] = &Chip8::OP_6xkk;
-    table[0x7] = &Chip8::OP_7xkk;
-    table[0x8] = &Chip8::Table8;
-    table[0x9] = &Chip8::OP_9xy0;
-    table[0xA] = &Chip8::OP_Annn;
-    table[0xB] = &Chip8::OP_Bnnn;
-    table[0xC] = &Chip8::OP_Cxkk;
-    table[0xD] = &Chip8::OP_Dxyn;
-    table[0xE] = &Chip8::TableE;
-    table[0xF] = &Chip8::TableF;
-
-    for (size_t i = 0; i < 0xE; i++) {
-        table0[i] = &Chip8::OP_NULL;
-        table8[i] = &Chip8::OP_NULL;
-        tableE[i] = &Chip8::OP_NULL;
-    }
-
-    table0[0x0] = &Chip8::OP_00E0;
-    table0[0xE] = &Chip8::OP_00EE;
-
-    table8[0x0] = &Chip8::OP_8xy0;
-    table8[0x1] = &Chip8::OP_8xy1;
-    table8[0x2] = &Chip8::OP_8xy2;
-    table8[0x3] = &Chip8::OP_8xy3;
-    table8[0x4] = &Chip8::OP_8xy4;
-    table8[0x5] = &Chip8::OP_8xy5;
-    table8[0x6] = &Chip8::OP_8xy6;
-    table8[0x7] = &Chip8::OP_8xy7;
-    table8[0xE] = &Chip8::OP_8xyE;
-
-    tableE[0x1] = &Chip8::OP_ExA1;
-    tableE[0x2] = &Chip8::OP_Ex9E;
-
-    for (size_t i = 0; i <= 0x65; i++) {
-        tableF[i] = &Chip8::OP_NULL;
-    }
-
-    tableF[0x07] = &Chip8::OP_Fx07;
-    tableF[0x0A] = &Chip8::OP_Fx0A;
-    tableF[0x15] = &Chip8::OP_Fx15;
-    tableF[0x18] = &Chip8::OP_Fx18;
-    tableF[0x1E] = &Chip8::OP_Fx1E;
-    tableF[0x29] = &Chip8::OP_Fx29;
-    tableF[0x33] = &Chip8::OP_Fx33;
-    tableF[0x55] = &Chip8::OP_Fx55;
-    tableF[0x65] = &Chip8::OP_Fx65;
-}
-
-void Chip8::LoadROM(const char *filename)
+    rng.Seed(0);
+
+    // Keep the caches' memory, but not what they remember about the old program
+    InvalidateDecoded(START_ADDRESS, DECODED_SIZE);
+}
+
+bool Chip8::LoadROM(const char *filename)
 {
-    // Open the file as a stream of binary and move the file pointer to the end.
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-
-    if (file.is_open())
-    {
-        // Get the size of the file and allocate a buffer to hold the contents
-        std::streampos size = file.tellg();
-        char* buffer = new char[size];
-
-        // Go back to the beginning of the file and fill the buffer
-        file.seekg(0, std::ios::beg);
-        file.read(buffer, size);
-        file.close();
-
-        // Load the ROM contents into the Chip8's memory, starting at 0x200
-        for (long i = 0; i < size; ++i)
-        {
-            memory[START_ADDRESS + i] = buffer[i];
+    // Map the file rather than reading it, the bytes get copied into memory exactly once
+    MappedFile file;
+
+    if (!file.Open(filename)) {
+        return false;
+    }
+
+    RomSpan rom = file.Span();
+
+    return LoadROM(rom.data, rom.size);
+}
+
+bool Chip8::LoadROM(uint8_t const* rom, size_t size)
+{
+    // Everything from 0x200 to the end of memory is available to the program
+    if (size > MemorySize() - START_ADDRESS) {
+        return false;
+    }
+
+    // Load the ROM contents into the Chip8's memory, starting at 0x200
+    if (size > 0) {
+        memcpy(&memory[START_ADDRESS], rom, size);
+    }
+
+    // Whatever was decoded before belongs to the previous ROM
+    InvalidateDecoded(START_ADDRESS, DECODED_SIZE);
+
+    return true;
+}
+
+// SAVE STATES
+
+const uint8_t STATE_MAGIC[4] = {'C', '8', 'S', 'T'};
+const uint8_t STATE_VERSION = 3;
+const size_t STATE_SIZE = sizeof(STATE_MAGIC) + 1 + 1 + 16 + MEMORY_SIZE + 2 + 2 + 16 * 2 + 1 + 1 + 1 + 2 + VIDEO_HEIGHT * 8 + 8;
+
+// What the extended profiles add on top: the extended display and its modes, the flag
+// registers and the audio registers, and for XO-CHIP the memory past the first 4KB
+const size_t EXTENDED_STATE_SIZE = 1 + 1 + 16 + 16 + 1 + PLANE_COUNT * HIRES_HEIGHT * 2 * 8;
+const size_t XO_STATE_SIZE = EXTENDED_MEMORY_SIZE - MEMORY_SIZE;
+
+static size_t StateSize(Quirks quirks) {
+    switch (quirks) {
+        case Quirks::SuperChip:
+            return STATE_SIZE + EXTENDED_STATE_SIZE;
+        case Quirks::XoChip:
+            return STATE_SIZE + EXTENDED_STATE_SIZE + XO_STATE_SIZE;
+        default:
+            return STATE_SIZE;
+    }
+}
+
+// Everything wider than a byte is stored little-endian
+static void PutBytes(std::vector<uint8_t>& state, uint64_t value, unsigned int bytes) {
+    for (unsigned int i = 0; i < bytes; ++i) {
+        state.push_back((value >> (8u * i)) & 0xFFu);
+    }
+}
+
+static uint64_t GetBytes(uint8_t const*& state, unsigned int bytes) {
+    uint64_t value = 0;
+
+    for (unsigned int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(*state++) << (8u * i);
+    }
+
+    return value;
+}
+
+void Chip8::SaveState(std::vector<uint8_t>& state) const {
+    state.reserve(state.size() + StateSize(quirks));
+
+    state.insert(state.end(), STATE_MAGIC, STATE_MAGIC + sizeof(STATE_MAGIC));
+    state.push_back(STATE_VERSION);
+    state.push_back(static_cast<uint8_t>(quirks));
+
+    state.insert(state.end(), registers, registers + 16);
+    state.insert(state.end(), memory, memory + MEMORY_SIZE);
+    PutBytes(state, index, 2);
+    PutBytes(state, pc, 2);
+
+    for (uint16_t level : stack) {
+        PutBytes(state, level, 2);
+    }
+
+    state.push_back(sp);
+    state.push_back(delayTimer);
+    state.push_back(soundTimer);
+
+    PutBytes(state, keys, 2);
+
+    for (uint64_t screenRow : video) {
+        PutBytes(state, screenRow, 8);
+    }
+
+    PutBytes(state, rng.State(), 8);
+
+    if (!Extended()) {
+        return;
+    }
+
+    state.push_back(hires);
+    state.push_back(planeMask);
+    state.insert(state.end(), flags, flags + 16);
+    state.insert(state.end(), audioPattern, audioPattern + 16);
+    state.push_back(pitch);
+
+    for (auto const& plane : extendedVideo) {
+        for (auto const& screenRow : plane) {
+            PutBytes(state, screenRow[0], 8);
+            PutBytes(state, screenRow[1], 8);
         }
+    }
+
+    if (quirks == Quirks::XoChip) {
+        state.insert(state.end(), memory + MEMORY_SIZE, memory + EXTENDED_MEMORY_SIZE);
+    }
+}
+
+bool Chip8::LoadState(uint8_t const* state, size_t size) {
+    if (size < STATE_SIZE || memcmp(state, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0
+        || state[sizeof(STATE_MAGIC)] != STATE_VERSION) {
+        return false;
+    }
+
+    // A state carries its profile along, since that decides what else is in it
+    uint8_t savedQuirks = state[sizeof(STATE_MAGIC) + 1];
+
+    if (savedQuirks > static_cast<uint8_t>(Quirks::XoChip) || size != StateSize(static_cast<Quirks>(savedQuirks))) {
+        return false;
+    }
+
+    if (static_cast<Quirks>(savedQuirks) != quirks) {
+        SetQuirks(static_cast<Quirks>(savedQuirks));
+    }
+
+    state += sizeof(STATE_MAGIC) + 2;
+
+    memcpy(registers, state, 16);
+    state += 16;
+    memcpy(memory, state, MEMORY_SIZE);
+    state += MEMORY_SIZE;
+    index = GetBytes(state, 2);
+    pc = GetBytes(state, 2);
 
-        // Free the buffer
-        delete[] buffer;
+    for (uint16_t& level : stack) {
+        level = GetBytes(state, 2);
+    }
+
+    sp = *state++;
+    delayTimer = *state++;
+    soundTimer = *state++;
+
+    keys = GetBytes(state, 2);
+
+    for (uint64_t& screenRow : video) {
+        screenRow = GetBytes(state, 8);
+    }
+
+    rng.SetState(GetBytes(state, 8));
+
+    if (Extended()) {
+        hires = *state++ != 0;
+        planeMask = *state++;
+        memcpy(flags, state, 16);
+        state += 16;
+        memcpy(audioPattern, state, 16);
+        state += 16;
+        pitch = *state++;
+
+        for (auto& plane : extendedVideo) {
+            for (auto& screenRow : plane) {
+                screenRow[0] = GetBytes(state, 8);
+                screenRow[1] = GetBytes(state, 8);
+            }
+        }
+
+        if (quirks == Quirks::XoChip) {
+            memcpy(memory + MEMORY_SIZE, state, XO_STATE_SIZE);
+        }
+    }
+
+    // All of memory may have changed, and so has the whole display
+    InvalidateDecoded(START_ADDRESS, DECODED_SIZE);
+    dirtyRows = 0xFFFFFFFFu;
+
+    // If the state was saved while waiting for a key, OP_Fx0A runs again and blocks again
+    waitingForKey = false;
+
+    return true;
+}
+
+void Chip8::PrepareCaches() {
+    // Only the engine that uses them needs them, and only once it actually runs
+    if (dispatch == Dispatch::Cached && !decoded) {
+        decoded.reset(new DecodedInstruction[DECODED_SIZE]{});
+    }
+
+    if (dispatch == Dispatch::Recompiler && !blocks) {
+        blocks.reset(new std::unique_ptr<Block>[DECODED_SIZE]);
     }
 }
 
 void Chip8::Cycle() {
-    // Fetch
-    opcode = (memory[pc] << 8u) | memory[pc + 1];
+    PrepareCaches();
+
+    switch (dispatch) {
+        case Dispatch::Table:
+            CycleTable();
+            break;
+        case Dispatch::Switch:
+            CycleSwitch();
+            break;
+        case Dispatch::Cached:
+            CycleCached();
+            break;
+        case Dispatch::Recompiler:
+            CycleRecompiled(MAX_BLOCK_LENGTH);
+            break;
+    }
+}
 
-    // Increment the PC before we execute anything
-    pc += 2;
+unsigned int Chip8::RunFor(unsigned int cycles) {
+    /* Picking the engine once outside the loop leaves nothing in it but the dispatch
+     * itself. The recompiler counts every instruction of a block against the budget, and
+     * is told how much is left so a block never runs past it.
+     */
+    return RunBudget(cycles, [this](unsigned int budget) {
+        return RunEngine(budget);
+    });
+}
 
-    // Decode and Execute
-    ((*this).*table[(opcode & 0xF000u) >> 12u]))();
+unsigned int Chip8::SkipIdleTrips(unsigned int remaining) {
+    // Whole trips round the loop leave everything as it was, so only the rest of a trip
+    // needs running, and that never gets as far as the jump closing the loop
+    unsigned int partial = remaining % idleLoop;
+
+    idleCycles += remaining - partial;
+    idleLoop = 0;
+
+    return partial;
+}
 
+// The engine loops themselves, up to the budget, a blocking OP_Fx0A or an idle loop
+unsigned int Chip8::RunEngine(unsigned int cycles) {
+    unsigned int executed = 0;
+
+    switch (dispatch) {
+        case Dispatch::Table:
+            for (; executed < cycles && !waitingForKey && !idleLoop; ++executed) {
+                CycleTable();
+            }
+            break;
+        case Dispatch::Switch:
+            executed = WithQuirks(quirks, [&](auto policy) {
+                return RunSwitch<decltype(policy)>(cycles);
+            });
+            break;
+        case Dispatch::Cached:
+            for (; executed < cycles && !waitingForKey && !idleLoop; ++executed) {
+                CycleCached();
+            }
+            break;
+        case Dispatch::Recompiler:
+            while (executed < cycles && !waitingForKey && !idleLoop) {
+                executed += CycleRecompiled(cycles - executed);
+            }
+            break;
+    }
+
+    return executed;
+}
+
+void Chip8::Seed(uint64_t seed) {
+    rng.Seed(seed);
+}
+
+bool Chip8::AnyKeyPressed() const {
+    return keys != 0;
+}
+
+bool Chip8::KeyPressed(uint8_t key) const {
+    return (keys >> (key & 0xFu)) & 0x1u;
+}
+
+void Chip8::SetKey(uint8_t key, bool pressed) {
+    if (pressed) {
+        keys |= 1u << (key & 0xFu);
+    } else {
+        keys &= ~(1u << (key & 0xFu));
+    }
+}
+
+unsigned int Chip8::RunFrame(unsigned int instructionsPerFrame) {
+    unsigned int executed = RunFor(instructionsPerFrame);
+
+    TickTimers();
+
+    return executed;
+}
+
+void Chip8::TickTimers() {
     // Decrement the delay timer if it's been set
     if (delayTimer > 0) {
         --delayTimer;
@@ -124,22 +555,450 @@ void Chip8::Cycle() {
     }
 }
 
+void Chip8::Fetch() {
+    opcode = (memory[pc & addressMask] << 8u) | memory[(pc + 1u) & addressMask];
+    ++familyCounts[opcode >> 12u];
+
+    // Increment the PC before we execute anything
+    pc += 2;
+}
+
+// Expand the packed 64x32 display into one RGBA8888 pixel per screen pixel, on or off. The
+// extended display is left to Screen().
+void Chip8::Render(uint32_t* pixels) const {
+    for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row) {
+        uint64_t screenRow = video[row];
+
+        for (unsigned int col = 0; col < VIDEO_WIDTH; ++col) {
+            pixels[row * VIDEO_WIDTH + col] = (screenRow >> (63u - col)) & 0x1u ? 0xFFFFFFFF : 0x00000000;
+        }
+    }
+}
+
+// FNV-1a over the packed display, for telling frames apart without looking at them
+uint64_t Chip8::VideoHash() const {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    Display display = Screen();
+
+    for (size_t word = 0; word < display.Words(); ++word) {
+        uint64_t screenRow = display.rows[word];
+
+        for (unsigned int byte = 0; byte < 8; ++byte) {
+            hash ^= (screenRow >> (56u - 8u * byte)) & 0xFFu;
+            hash *= 0x100000001B3ull;
+        }
+    }
+
+    return hash;
+}
+
+Chip8::Display Chip8::Screen() const {
+    if (!Extended()) {
+        return {video, VIDEO_WIDTH, VIDEO_HEIGHT, 1};
+    }
+
+    // SUPER-CHIP never selects the second plane, so there's no point showing it
+    return {&extendedVideo[0][0][0], HIRES_WIDTH, HIRES_HEIGHT, quirks == Quirks::XoChip ? PLANE_COUNT : 1};
+}
+
+// DISPATCH ENGINES
+
+void Chip8::CycleTable() {
+    Fetch();
+
+    ((*this).*(tables->table[(opcode & 0xF000u) >> 12u]))();
+}
+
+void Chip8::CycleSwitch() {
+    WithQuirks(quirks, [this](auto policy) {
+        CycleSwitch<decltype(policy)>();
+    });
+}
+
+template <typename QuirksPolicy>
+unsigned int Chip8::RunSwitch(unsigned int cycles) {
+    // The profile is picked once per batch, so the loop runs the one specialized switch
+    unsigned int executed = 0;
+
+    for (; executed < cycles && !waitingForKey && !idleLoop; ++executed) {
+        CycleSwitch<QuirksPolicy>();
+    }
+
+    return executed;
+}
+
+template <typename QuirksPolicy>
+void Chip8::CycleSwitch() {
+    // Decodes exactly like the tables do (the 0, 8 and E families on the low nibble, the F
+    // family on the low byte) so both engines agree on every opcode, including the ones
+    // that end up in OP_NULL. The instructions only the extended profiles have are rare
+    // enough to be left to the tables.
+    Fetch();
+
+    switch ((opcode & 0xF000u) >> 12u) {
+        case 0x0:
+            if constexpr (QuirksPolicy::superChip) {
+                switch (opcode & 0x00FFu) {
+                    case 0xE0: OP_00E0<QuirksPolicy>(); break;
+                    case 0xEE: OP_00EE(); break;
+                    default: Table0(); break;
+                }
+            } else {
+                switch (opcode & 0x000Fu) {
+                    case 0x0: OP_00E0<QuirksPolicy>(); break;
+                    case 0xE: OP_00EE(); break;
+                    default: OP_NULL(); break;
+                }
+            }
+            break;
+        case 0x1: OP_1nnn(); break;
+        case 0x2: OP_2nnn(); break;
+        case 0x3: OP_3xkk<QuirksPolicy>(); break;
+        case 0x4: OP_4xkk<QuirksPolicy>(); break;
+        case 0x5:
+            if constexpr (QuirksPolicy::xoChip) {
+                Table5();
+            } else {
+                OP_5xy0<QuirksPolicy>();
+            }
+            break;
+        case 0x6: OP_6xkk(); break;
+        case 0x7: OP_7xkk(); break;
+        case 0x8:
+            switch (opcode & 0x000Fu) {
+                case 0x0: OP_8xy0(); break;
+                case 0x1: OP_8xy1(); break;
+                case 0x2: OP_8xy2(); break;
+                case 0x3: OP_8xy3(); break;
+                case 0x4: OP_8xy4(); break;
+                case 0x5: OP_8xy5(); break;
+                case 0x6: OP_8xy6<QuirksPolicy>(); break;
+                case 0x7: OP_8xy7(); break;
+                case 0xE: OP_8xyE<QuirksPolicy>(); break;
+                default: OP_NULL(); break;
+            }
+            break;
+        case 0x9: OP_9xy0<QuirksPolicy>(); break;
+        case 0xA: OP_Annn(); break;
+        case 0xB: OP_Bnnn<QuirksPolicy>(); break;
+        case 0xC: OP_Cxkk(); break;
+        case 0xD: OP_Dxyn<QuirksPolicy>(); break;
+        case 0xE:
+            switch (opcode & 0x000Fu) {
+                case 0x1: OP_ExA1<QuirksPolicy>(); break;
+                case 0xE: OP_Ex9E<QuirksPolicy>(); break;
+                default: OP_NULL(); break;
+            }
+            break;
+        case 0xF:
+            switch (opcode & 0x00FFu) {
+                case 0x07: OP_Fx07(); break;
+                case 0x0A: OP_Fx0A(); break;
+                case 0x15: OP_Fx15(); break;
+                case 0x18: OP_Fx18(); break;
+                case 0x1E: OP_Fx1E(); break;
+                case 0x29: OP_Fx29(); break;
+                case 0x33: OP_Fx33(); break;
+                case 0x55: OP_Fx55<QuirksPolicy>(); break;
+                case 0x65: OP_Fx65<QuirksPolicy>(); break;
+                default: TableF(); break;
+            }
+            break;
+    }
+}
+
+void Chip8::CycleCached() {
+    // Only program memory is cached. Anything below 0x200 (or the very last byte, which
+    // can't hold a whole instruction) takes the regular table path.
+    if (pc < START_ADDRESS || pc >= MEMORY_SIZE - 1) {
+        CycleTable();
+        return;
+    }
+
+    DecodedInstruction& entry = decoded[pc - START_ADDRESS];
+
+    if (entry.handler == nullptr) {
+        entry.opcode = (memory[pc] << 8u) | memory[pc + 1];
+        entry.handler = Resolve(entry.opcode);
+    }
+
+    opcode = entry.opcode;
+    pc += 2;
+    ++familyCounts[opcode >> 12u];
+
+    ((*this).*(entry.handler))();
+}
+
+unsigned int Chip8::CycleRecompiled(unsigned int budget) {
+    // Same as the cache, only program memory is compiled
+    if (pc < START_ADDRESS || pc >= MEMORY_SIZE - 1) {
+        CycleTable();
+        return 1;
+    }
+
+    std::unique_ptr<Block>& slot = blocks[pc - START_ADDRESS];
+
+    if (!slot) {
+        slot = Compile(pc);
+    }
+
+    // Not enough of the budget left for the whole block, so step through it instead
+    if (slot->length > budget) {
+        CycleTable();
+        return 1;
+    }
+
+    /* The last instruction may store into this very block, which frees it. Everything
+     * needed after that point is copied out first.
+     */
+    Block const& block = *slot;
+    unsigned int length = block.length;
+    DecodedInstruction last = block.ops[length - 1];
+
+    for (unsigned int i = 0; i < length - 1; ++i) {
+        opcode = block.ops[i].opcode;
+        ++familyCounts[opcode >> 12u];
+        ((*this).*(block.ops[i].handler))();
+    }
+
+    pc = block.end;
+    opcode = last.opcode;
+    ++familyCounts[opcode >> 12u];
+    ((*this).*(last.handler))();
+
+    return length;
+}
+
+// Whether an instruction has to be the last one of a basic block
+static bool EndsBlock(uint16_t instruction) {
+    switch ((instruction & 0xF000u) >> 12u) {
+        case 0x0:
+            // 00EE, decoded on the low nibble like Table0 does for CHIP-8, and SUPER-CHIP's
+            // 00FD, which stops on itself
+            return (instruction & 0x000Fu) == 0xE || (instruction & 0x00FFu) == 0xFD;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xB:
+        case 0xE:
+            return true;
+        case 0xF:
+            switch (instruction & 0x00FFu) {
+                // XO-CHIP's F000 nnnn reads its second half from the PC
+                case 0x00:
+                case 0x0A:
+                case 0x33:
+                case 0x55:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+std::unique_ptr<Chip8::Block> Chip8::Compile(uint16_t address) const {
+    std::unique_ptr<Block> block(new Block{});
+    block->start = address;
+
+    uint16_t at = address;
+
+    while (block->length < MAX_BLOCK_LENGTH && at < MEMORY_SIZE - 1) {
+        uint16_t instruction = (memory[at] << 8u) | memory[at + 1];
+
+        block->ops[block->length].opcode = instruction;
+        block->ops[block->length].handler = Resolve(instruction);
+        ++block->length;
+        at += 2;
+
+        if (EndsBlock(instruction)) {
+            break;
+        }
+    }
+
+    block->end = at;
+
+    return block;
+}
+
+// Find the OP_ function an opcode ends up in, walking both levels of the tables
+Chip8::Chip8Func Chip8::Resolve(uint16_t instruction) const {
+    return Resolve(*tables, instruction);
+}
+
+Chip8::Chip8Func Chip8::Resolve(DispatchTables const& tables, uint16_t instruction) {
+    switch ((instruction & 0xF000u) >> 12u) {
+        case 0x0:
+            return tables.table0[instruction & 0x00FFu];
+        case 0x5:
+            return tables.table5[instruction & 0x000Fu];
+        case 0x8:
+            return tables.table8[instruction & 0x000Fu];
+        case 0xE:
+            return tables.tableE[instruction & 0x000Fu];
+        case 0xF:
+            return tables.tableF[instruction & 0x00FFu];
+        default:
+            return tables.table[(instruction & 0xF000u) >> 12u];
+    }
+}
+
+// IDLE LOOPS
+/* Goes once round the loop starting at start without executing it, the way the machine
+ * would with its current state, and returns how many instructions that took if it came
+ * back to start having changed nothing, or 0 if it didn't.
+ *
+ * Only instructions that read the registers, the delay timer or the keys are allowed, or
+ * write a register with the value it already has, and the loop has to close with a jump
+ * back to start within MAX_IDLE_LOOP instructions. The timers and keys only change
+ * between batches, so a loop like that takes the same path every time round from here
+ * until the end of the batch. What the skips decide is followed like the real thing, so
+ * a skip that would leave the loop means it isn't idle.
+ */
+unsigned int Chip8::IdleLoopLength(uint16_t start) const {
+    uint16_t address = start;
+
+    for (unsigned int length = 1; length <= MAX_IDLE_LOOP; ++length) {
+        if (address >= MEMORY_SIZE - 1) {
+            return 0;
+        }
+
+        uint16_t instruction = (memory[address] << 8u) | memory[address + 1];
+        uint8_t Vx = (instruction & 0x0F00u) >> 8u;
+        uint8_t Vy = (instruction & 0x00F0u) >> 4u;
+        uint8_t byte = instruction & 0x00FFu;
+        bool skip = false;
+
+        address += 2;
+
+        // Decoded the same way the tables do
+        switch ((instruction & 0xF000u) >> 12u) {
+            case 0x1:
+                return (instruction & 0x0FFFu) == start ? length : 0;
+            case 0x3:
+                skip = registers[Vx] == byte;
+                break;
+            case 0x4:
+                skip = registers[Vx] != byte;
+                break;
+            case 0x5:
+                // Not XO-CHIP's 5xy2 or 5xy3
+                if ((instruction & 0x000Fu) != 0) {
+                    return 0;
+                }
+
+                skip = registers[Vx] == registers[Vy];
+                break;
+            case 0x6:
+                if (registers[Vx] != byte) {
+                    return 0;
+                }
+                break;
+            case 0x9:
+                skip = registers[Vx] != registers[Vy];
+                break;
+            case 0xE:
+                if ((instruction & 0x000Fu) == 0xE) {
+                    skip = KeyPressed(registers[Vx]);
+                } else if ((instruction & 0x000Fu) == 0x1) {
+                    skip = !KeyPressed(registers[Vx]);
+                } else {
+                    return 0;
+                }
+                break;
+            case 0xF:
+                if (byte != 0x07 || registers[Vx] != delayTimer) {
+                    return 0;
+                }
+                break;
+            default:
+                return 0;
+        }
+
+        if (skip) {
+            bool longInstruction = quirks == Quirks::XoChip && memory[address] == 0xF0 && memory[address + 1] == 0x00;
+
+            address += longInstruction ? 4 : 2;
+        }
+    }
+
+    return 0;
+}
+
+// Forget the decoded instructions and compiled blocks covering [address, address + count)
+void Chip8::InvalidateDecoded(uint16_t address, uint16_t count) {
+    // The stores wrap round the end of memory, so the bytes they wrote are at the masked
+    // addresses, and a run that goes off the end carries on from 0
+    unsigned int first = address & addressMask;
+    unsigned int size = addressMask + 1u;
+
+    if (first + count > size) {
+        InvalidateRange(first, size - first);
+        InvalidateRange(0, first + count - size);
+    } else {
+        InvalidateRange(first, count);
+    }
+}
+
+void Chip8::InvalidateRange(unsigned int address, unsigned int count) {
+    unsigned int last = address + count;
+
+    if (last > MEMORY_SIZE) {
+        last = MEMORY_SIZE;
+    }
+
+    if (last <= START_ADDRESS) {
+        return;
+    }
+
+    if (decoded) {
+        // An instruction starting one byte before the range has its low byte inside it
+        unsigned int first = address > START_ADDRESS ? address - 1u : START_ADDRESS;
+
+        for (unsigned int i = first; i < last; ++i) {
+            decoded[i - START_ADDRESS].handler = nullptr;
+        }
+    }
+
+    if (blocks) {
+        // Any block overlapping the range starts at most one block length before it
+        unsigned int reach = 2 * MAX_BLOCK_LENGTH;
+        unsigned int first = address > START_ADDRESS + reach ? address - reach : START_ADDRESS;
+
+        for (unsigned int i = first; i < last; ++i) {
+            std::unique_ptr<Block>& slot = blocks[i - START_ADDRESS];
+
+            if (slot && slot->end > address) {
+                slot.reset();
+            }
+        }
+    }
+}
+
 // TABLES
 
 void Chip8::Table0() {
-    ((*this).*(table0[opcode & 0x000Fu]))();
+    ((*this).*(tables->table0[opcode & 0x00FFu]))();
+}
+
+void Chip8::Table5() {
+    ((*this).*(tables->table5[opcode & 0x000Fu]))();
 }
 
 void Chip8::Table8() {
-    ((*this).*(tableE[opcode & 0x000Fu]))();
+    ((*this).*(tables->table8[opcode & 0x000Fu]))();
 }
 
 void Chip8::TableE() {
-    ((*this).*(tableE[opcode & 0x000Fu]))();
+    ((*this).*(tables->tableE[opcode & 0x000Fu]))();
 }
 
 void Chip8::TableF() {
-    ((*this).*(tableF[opcode & 0x00FFu]));
+    ((*this).*(tables->tableF[opcode & 0x00FFu]))();
 }
 
 
@@ -151,9 +1010,16 @@ void Chip8::OP_NULL() {
 }
 
 // Clear the display
+template <typename QuirksPolicy>
 void Chip8::OP_00E0() {
-    // We can simply set the entire video buffer to zeroes.
-    memset(video, 0, sizeof(video));
+    if constexpr (QuirksPolicy::superChip) {
+        ClearExtended();
+    } else {
+        // We can simply set the entire video buffer to zeroes.
+        memset(video, 0, sizeof(video));
+    }
+
+    dirtyRows = 0xFFFFFFFFu;
 }
 
 // Return from subroutine
@@ -162,7 +1028,7 @@ void Chip8::OP_00EE() {
     // the subroutine, so we can put that back into the PC. Note that this overwrites our
     // preemptive pc += 2 earlier.
     --sp;
-    pc = stack[sp];
+    pc = stack[sp & 0xFu];
 }
 
 // Jump to location nnn
@@ -171,6 +1037,13 @@ void Chip8::OP_1nnn() {
     // A jump doesn't remember its origin, so no stack interaction is required.
     uint16_t address = opcode & 0x0FFFu;
 
+    // Going back a few instructions may close an idle loop
+    unsigned int origin = static_cast<uint16_t>(pc - 2);
+
+    if (skipIdleLoops && address <= origin && origin - address < 2u * MAX_IDLE_LOOP) {
+        idleLoop = IdleLoopLength(address);
+    }
+
     pc = address;
 }
 
@@ -184,12 +1057,14 @@ void Chip8::OP_2nnn() {
      */
     uint16_t address = opcode & 0x0FFFu;
 
-    stack[sp] = pc;
+    // Sixteen levels and no more: deeper calls wrap round and overwrite the bottom ones
+    stack[sp & 0xFu] = pc;
     ++sp;
     pc = address;
 }
 
 // Skip next instruction if Vx = kk
+template <typename QuirksPolicy>
 void Chip8::OP_3xkk() {
     // Since our PC has already been incremented by 2 in Cycle(), we can just increment
     // by 2 again to skip the next instruction;
@@ -197,23 +1072,25 @@ void Chip8::OP_3xkk() {
     uint8_t byte = opcode & 0x00FFu;
 
     if (registers[Vx] == byte) {
-        pc += 2;
+        SkipNext<QuirksPolicy>();
     }
 }
 
 // Skip next instruction if Vx != kk.
+template <typename QuirksPolicy>
 void Chip8::OP_4xkk() {
     // Since our PC has already been incremented by 2 in Cycle(), we can just increment
     // by 2 again to skip the next instruction.
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-    uint8_t byte = opcode & 0x00Fu;
+    uint8_t byte = opcode & 0x00FFu;
 
     if (registers[Vx] != byte) {
-        pc += 2;
+        SkipNext<QuirksPolicy>();
     }
 }
 
 // Skip next instruction if Vx = Vy
+template <typename QuirksPolicy>
 void Chip8::OP_5xy0() {
     // Since our PC has already been incremented by 2 in Cycle(), we can just increment
     // by 2 again to skip the next instruction
@@ -221,7 +1098,7 @@ void Chip8::OP_5xy0() {
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
 
     if (registers[Vx] == registers[Vy]) {
-        pc += 2;
+        SkipNext<QuirksPolicy>();
     }
 }
 
@@ -286,7 +1163,7 @@ void Chip8::OP_8xy4() {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
 
-    uint16_t sum - registers[Vx] + registers[Vy];
+    uint16_t sum = registers[Vx] + registers[Vy];
 
     if (sum > 255U) {
         registers[0xF] = 1;
@@ -318,10 +1195,17 @@ void Chip8::OP_8xy5() {
 // Set Vx = Vx SHR 1
 // If the least significant bit of Vx is 1, then VF is set to 1, otherwise 0.
 // Then Vx is divided by 2.
+template <typename QuirksPolicy>
 void Chip8::OP_8xy6() {
     // A right shift is performed (division by 2), and the least significant bit is
     // saved in Register VF;
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+
+    // The COSMAC VIP shifted Vy and put the result in Vx
+    if constexpr (QuirksPolicy::shiftVy) {
+        registers[Vx] = registers[Vy];
+    }
 
     // Save LSB in VF
     registers[0xF] = (registers[Vx] & 0x1u);
@@ -348,10 +1232,17 @@ void Chip8::OP_8xy7() {
 // Set Vx = Vx SHL 1
 // If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0.
 // Then Vx is multiplied by 2.
+template <typename QuirksPolicy>
 void Chip8::OP_8xyE() {
     // A left shift is performed (multiplication by 2), and the most significant
     // bit is saved in Register VF.
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+
+    // The COSMAC VIP shifted Vy and put the result in Vx
+    if constexpr (QuirksPolicy::shiftVy) {
+        registers[Vx] = registers[Vy];
+    }
 
     // Save MSB in VF
     registers[0xF] = (registers[Vx] & 0x80u) >> 7u;
@@ -360,6 +1251,7 @@ void Chip8::OP_8xyE() {
 }
 
 // Skip next instruction if Vx != Vy
+template <typename QuirksPolicy>
 void Chip8::OP_9xy0() {
     // Since our PC has already been incremented by 2 in Cycle(), we can just
     // increment by 2 again to skip the next instruction.
@@ -367,7 +1259,7 @@ void Chip8::OP_9xy0() {
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
 
     if (registers[Vx] != registers[Vy]) {
-        pc +=2;
+        SkipNext<QuirksPolicy>();
     }
 }
 
@@ -379,10 +1271,18 @@ void Chip8::OP_Annn() {
 }
 
 // Jump to location nnn + V0
+template <typename QuirksPolicy>
 void Chip8::OP_Bnnn() {
     uint16_t address = opcode & 0x0FFFu;
 
-    pc = registers[0] + address;
+    // SUPER-CHIP read it as Bxnn, jumping to xnn + Vx
+    if constexpr (QuirksPolicy::jumpVx) {
+        uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+
+        pc = registers[Vx] + address;
+    } else {
+        pc = registers[0] + address;
+    }
 }
 
 // Set Vx = random byte and kk
@@ -390,22 +1290,31 @@ void Chip8::OP_Cxkk() {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t byte = opcode & 0x00FFu;
 
-    registers[Vx] = randByte(randGen) & byte;
+    registers[Vx] = rng.NextByte() & byte;
 }
 
 // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+template <typename QuirksPolicy>
 void Chip8::OP_Dxyn() {
-    /* We iterate over the sprite, row by row and column by column. We know there are
-     * eight columns because a sprite is guaranteed to be eight pixels wide.
+    /* A sprite is guaranteed to be eight pixels wide, so each sprite row is a single byte.
+     * We shift that byte into the position it has on the screen row, at which point it
+     * lines up bit for bit with the packed row in video.
      *
-     * If a sprite pixel is on then there may be a collision with what's already being
-     * displayed, so we check if our screen pixel in the same location is set. If so,
-     * we must set hte VF register to express collision.
+     * If any sprite pixel lands on a screen pixel that is already on there's a collision,
+     * and one AND of the two rows tells us that for all eight pixels at once. Then the
+     * sprite row can be XORed straight into the screen row.
      *
-     * Then we can just XOR the screen pixel with 0xFFFFFFFF to essentially XOR it with
-     * the sprite pixel (which we now know is on). We can't XOR directly because the sprite
-     * pixel is either 1 or 0, while our video pixel is either 0x00000000 or 0xFFFFFFFF.
+     * Parts of the sprite that go past the right or bottom edge are clipped: the shift
+     * drops the pixels past the right edge and rows past the bottom are skipped. With
+     * wrapSprites they come back in on the other side instead: a row is exactly one word
+     * wide, so a rotate wraps its pixels around, and rows carry on from the top.
      */
+    ++spritesDrawn;
+
+    if constexpr (QuirksPolicy::superChip) {
+        DrawExtended<QuirksPolicy>();
+        return;
+    }
 
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
@@ -418,27 +1327,38 @@ void Chip8::OP_Dxyn() {
     registers[0xF] = 0;
 
     for (unsigned int row = 0; row < height; ++row) {
-        uint8_t spriteByte = memory[index + row];
+        unsigned int y = yPos + row;
+        uint64_t sprite = static_cast<uint64_t>(memory[(index + row) & addressMask]) << 56u;
+        uint64_t spriteRow;
+
+        if constexpr (QuirksPolicy::wrapSprites) {
+            y %= VIDEO_HEIGHT;
+            spriteRow = xPos ? (sprite >> xPos) | (sprite << (VIDEO_WIDTH - xPos)) : sprite;
+        } else {
+            if (y >= VIDEO_HEIGHT) {
+                break;
+            }
 
-        for (unsigned int col = 0; col < 8; ++col) {
-            uint8_t spritePixel = spriteByte & (0x80u >> col);
-            uint32_t* screenPixel = &video[(yPos + row) * VIDEO_WIDTH + (xPod + col)];
+            spriteRow = sprite >> xPos;
+        }
 
-            // Sprite pixel is on
-            if (spritePixel) {
-                // Screen pixel also on - collision
-                if (*screenPixel == 0xFFFFFFFF) {
-                    registers[0xF] = 1;
-                }
+        uint64_t& screenRow = video[y];
 
-                // Effectively XOR with the sprite pixel
-                *screenPixel ^= 0xFFFFFFFF;
-            }
+        // Any pixel on in both - collision
+        if (screenRow & spriteRow) {
+            registers[0xF] = 1;
+        }
+
+        screenRow ^= spriteRow;
+
+        if (spriteRow) {
+            dirtyRows |= 1u << y;
         }
     }
 }
 
 // Skip next instruction if key with the value of Vx is pressed.
+template <typename QuirksPolicy>
 void Chip8::OP_Ex9E() {
     // Since our PC has already been incremented by 2 in Cycle(), we can just
     // increment it by 2 again to skip the next instruction.
@@ -447,21 +1367,22 @@ void Chip8::OP_Ex9E() {
 
     uint8_t key = registers[Vx];
 
-    if (keypad[key]) {
-        pc += 2;
+    if (KeyPressed(key)) {
+        SkipNext<QuirksPolicy>();
     }
 }
 
 // Skip next instruction if key with the value of Vx is NOT pressed
-void Chip8::OP_Exa1() {
+template <typename QuirksPolicy>
+void Chip8::OP_ExA1() {
     // Since our PC has already been incremented by 2 in Cycle(), we can
     // just increment by 2 again to skip the next instruction.
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
     uint8_t key = registers[Vx];
 
-    if (!keypad[key]) {
-        pc += 2;
+    if (!KeyPressed(key)) {
+        SkipNext<QuirksPolicy>();
     }
 }
 
@@ -475,45 +1396,20 @@ void Chip8::OP_Fx07(){
 // Wait for a key press, store the value of the key in Vx.
 void Chip8::OP_Fx0A(){
     /* The easiest way to "wait" is to decrement the PC by 2 whenever a keypad value is
-     * not detected. This has the effect of running the same instruction repeatedly
+     * not detected. This has the effect of running the same instruction repeatedly.
+     *
+     * We also flag that the CPU is blocked, so the run loop can stop executing until a
+     * key is pressed instead of running this instruction over and over.
      */
 
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
-    if (keypad[0]) {
-        registers[Vx] = 0;
-    } else if (keypad[1]) {
-        registers[Vx] = 1;
-    } else if (keypad[2]) {
-        registers[Vx] = 2;
-    } else if (keypad[3]) {
-        registers[Vx] = 3;
-    } else if (keypad[4]) {
-        registers[Vx] = 4;
-    } else if (keypad[5]) {
-        registers[Vx] = 5;
-    } else if (keypad[6]) {
-        registers[Vx] = 6;
-    } else if (keypad[7]) {
-        registers[Vx] = 7;
-    } else if (keypad[8]) {
-        registers[Vx] = 8;
-    } else if (keypad[9]) {
-        registers[Vx] = 9;
-    } else if (keypad[10]) {
-        registers[Vx] = 10;
-    } else if (keypad[11]) {
-        registers[Vx] = 11;
-    } else if (keypad[12]) {
-        registers[Vx] = 12;
-    } else if (keypad[13]) {
-        registers[Vx] = 13;
-    } else if (keypad[14]) {
-        registers[Vx] = 14;
-    } else if (keypad[15]) {
-        registers[Vx] = 15;
+    // The lowest numbered key wins if several are down
+    if (keys) {
+        registers[Vx] = FirstKey(keys);
     } else {
         pc -= 2;
+        waitingForKey = true;
     }
 }
 
@@ -532,7 +1428,7 @@ void Chip8::OP_Fx18(){
 }
 
 // Set I = I + Vx
-void Chip8::OP_FX1E(){
+void Chip8::OP_Fx1E(){
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
     index += registers[Vx];
@@ -561,39 +1457,331 @@ void Chip8::OP_Fx33() {
     uint8_t value = registers[Vx];
 
     // Ones-place
-    memory[index + 2] = value % 10;
+    memory[(index + 2u) & addressMask] = value % 10;
     value /= 10;
 
     // Tens-place
-    memory[index + 1] = value % 10;
+    memory[(index + 1u) & addressMask] = value % 10;
     value /= 10;
 
     // Hundreds-place
-    memory[index] = value % 10;
+    memory[index & addressMask] = value % 10;
+
+    InvalidateDecoded(index, 3);
 }
 
 // Store registers V0 through Vx in memory starting at location I
+template <typename QuirksPolicy>
 void Chip8::OP_Fx55() {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
     for (uint8_t i = 0; i <= Vx; ++i) {
-        memory[index + i] = registers[i];
+        memory[(index + i) & addressMask] = registers[i];
+    }
+
+    InvalidateDecoded(index, Vx + 1);
+
+    // The COSMAC VIP moved I along as it went
+    if constexpr (QuirksPolicy::incrementIndex) {
+        index += Vx + 1;
     }
 }
 
 // Read registers V0 through Vx from memory starting at location I
+template <typename QuirksPolicy>
 void Chip8::OP_Fx65() {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
     for (uint8_t i = 0; i <= Vx; ++i) {
-        registers[i] = memory[index + i];
+        registers[i] = memory[(index + i) & addressMask];
+    }
+
+    // The COSMAC VIP moved I along as it went
+    if constexpr (QuirksPolicy::incrementIndex) {
+        index += Vx + 1;
+    }
+}
+
+// EXTENDED MODE
+
+template <typename QuirksPolicy>
+void Chip8::SkipNext() {
+    // XO-CHIP skips the whole of F000 nnnn
+    if constexpr (QuirksPolicy::xoChip) {
+        if (memory[pc & addressMask] == 0xF0 && memory[(pc + 1u) & addressMask] == 0x00) {
+            pc += 2;
+        }
     }
+
+    pc += 2;
 }
 
+void Chip8::ClearExtended() {
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if (planeMask & (1u << plane)) {
+            memset(extendedVideo[plane], 0, sizeof(extendedVideo[plane]));
+        }
+    }
+}
+
+// Rows down (positive) or up (negative), in pixels of the current resolution
+void Chip8::ScrollVertical(int rows) {
+    // Whole rows move, so it's one move of words per plane
+    unsigned int distance = (rows < 0 ? -rows : rows) * (hires ? 1u : 2u);
 
-typedef void (Chip8::*Chip8Func)();
-Chip8Func table[0xF + 1];
-Chip8Func table0[0xE + 1];
-Chip8Func table8[0xE + 1];
-Chip8Func tableE[0xE + 1];
-Chip8Func tableF[0x65 + 1];
+    if (distance > HIRES_HEIGHT) {
+        distance = HIRES_HEIGHT;
+    }
+
+    size_t kept = (HIRES_HEIGHT - distance) * sizeof(extendedVideo[0][0]);
+    size_t cleared = distance * sizeof(extendedVideo[0][0]);
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if (!(planeMask & (1u << plane))) {
+            continue;
+        }
+
+        uint64_t (*screen)[2] = extendedVideo[plane];
+
+        if (rows > 0) {
+            memmove(screen + distance, screen, kept);
+            memset(screen, 0, cleared);
+        } else {
+            memmove(screen, screen + distance, kept);
+            memset(screen + (HIRES_HEIGHT - distance), 0, cleared);
+        }
+    }
+
+    dirtyRows = 0xFFFFFFFFu;
+}
+
+// Pixels right (positive) or left (negative), in pixels of the current resolution
+void Chip8::ScrollHorizontal(int pixels) {
+    // Each row's two words shift as one 128-bit value, with the bits crossing between them
+    unsigned int distance = (pixels < 0 ? -pixels : pixels) * (hires ? 1u : 2u);
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if (!(planeMask & (1u << plane))) {
+            continue;
+        }
+
+        for (uint64_t* screenRow : extendedVideo[plane]) {
+            if (pixels > 0) {
+                screenRow[1] = (screenRow[1] >> distance) | (screenRow[0] << (64u - distance));
+                screenRow[0] >>= distance;
+            } else {
+                screenRow[0] = (screenRow[0] << distance) | (screenRow[1] >> (64u - distance));
+                screenRow[1] <<= distance;
+            }
+        }
+    }
+
+    dirtyRows = 0xFFFFFFFFu;
+}
+
+// Every one of the low 16 bits twice over, side by side, for drawing in low resolution
+static uint64_t DoublePixels(uint64_t bits) {
+    bits = (bits | (bits << 8u)) & 0x00FF00FFu;
+    bits = (bits | (bits << 4u)) & 0x0F0F0F0Fu;
+    bits = (bits | (bits << 2u)) & 0x33333333u;
+    bits = (bits | (bits << 1u)) & 0x55555555u;
+
+    return bits | (bits << 1u);
+}
+
+template <typename QuirksPolicy>
+void Chip8::DrawExtended() {
+    /* Like OP_Dxyn, only with rows two words wide. Sprites are 8 pixels wide and n rows
+     * high, or 16x16 for Dxy0. Everything is worked out in high resolution pixels: in low
+     * resolution a sprite row is spread out to double width and drawn on two rows.
+     *
+     * A sprite row goes into the top of a word and is shifted across the pair of words at
+     * its position, and whatever falls off the right edge either wraps into the first word
+     * or is dropped. It's drawn on each selected plane in turn, with the sprite data for
+     * the second plane following the first's.
+     */
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    uint8_t n = opcode & 0x000Fu;
+
+    unsigned int scale = hires ? 1u : 2u;
+    unsigned int width = n ? 8u : 16u;
+    unsigned int height = n ? n : 16u;
+
+    unsigned int xPos = (registers[Vx] % (HIRES_WIDTH / scale)) * scale;
+    unsigned int yPos = (registers[Vy] % (HIRES_HEIGHT / scale)) * scale;
+
+    uint16_t address = index;
+
+    registers[0xF] = 0;
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if (!(planeMask & (1u << plane))) {
+            continue;
+        }
+
+        for (unsigned int row = 0; row < height; ++row) {
+            uint64_t bits = memory[address++ & addressMask];
+
+            if (width == 16) {
+                bits = (bits << 8u) | memory[address++ & addressMask];
+            }
+
+            if (scale == 2) {
+                bits = DoublePixels(bits);
+            }
+
+            bits <<= 64u - width * scale;
+
+            uint64_t left = xPos < 64 ? bits >> xPos : 0;
+            uint64_t right = xPos < 64 ? (xPos ? bits << (64u - xPos) : 0) : bits >> (xPos - 64u);
+
+            if constexpr (QuirksPolicy::wrapSprites) {
+                left |= xPos > 64 ? bits << (128u - xPos) : 0;
+            }
+
+            for (unsigned int copy = 0; copy < scale; ++copy) {
+                unsigned int y = yPos + row * scale + copy;
+
+                if (y >= HIRES_HEIGHT) {
+                    if constexpr (!QuirksPolicy::wrapSprites) {
+                        continue;
+                    }
+
+                    y -= HIRES_HEIGHT;
+                }
+
+                uint64_t* screenRow = extendedVideo[plane][y];
+
+                // Any pixel on in both - collision
+                if ((screenRow[0] & left) | (screenRow[1] & right)) {
+                    registers[0xF] = 1;
+                }
+
+                screenRow[0] ^= left;
+                screenRow[1] ^= right;
+
+                if (left | right) {
+                    dirtyRows |= 1u << (y >> 1u);
+                }
+            }
+        }
+    }
+}
+
+// Scroll the display down n rows
+void Chip8::OP_00Cn() {
+    ScrollVertical(opcode & 0x000Fu);
+}
+
+// Scroll the display up n rows
+void Chip8::OP_00Dn() {
+    ScrollVertical(-static_cast<int>(opcode & 0x000Fu));
+}
+
+// Scroll the display right 4 pixels
+void Chip8::OP_00FB() {
+    ScrollHorizontal(4);
+}
+
+// Scroll the display left 4 pixels
+void Chip8::OP_00FC() {
+    ScrollHorizontal(-4);
+}
+
+// Exit the interpreter
+void Chip8::OP_00FD() {
+    // There's nothing to exit to, so the program just stops here
+    pc -= 2;
+}
+
+// Switch to low resolution, which starts out clear
+void Chip8::OP_00FE() {
+    hires = false;
+    memset(extendedVideo, 0, sizeof(extendedVideo));
+    dirtyRows = 0xFFFFFFFFu;
+}
+
+// Switch to high resolution, which starts out clear
+void Chip8::OP_00FF() {
+    hires = true;
+    memset(extendedVideo, 0, sizeof(extendedVideo));
+    dirtyRows = 0xFFFFFFFFu;
+}
+
+// Store Vx through Vy in memory starting at location I, leaving I alone
+void Chip8::OP_5xy2() {
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+
+    // The registers go in the order given, which can be backwards
+    int step = Vx <= Vy ? 1 : -1;
+    unsigned int count = (Vx <= Vy ? Vy - Vx : Vx - Vy) + 1u;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        memory[(index + i) & addressMask] = registers[Vx + step * static_cast<int>(i)];
+    }
+
+    InvalidateDecoded(index, count);
+}
+
+// Read Vx through Vy from memory starting at location I, leaving I alone
+void Chip8::OP_5xy3() {
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+
+    int step = Vx <= Vy ? 1 : -1;
+    unsigned int count = (Vx <= Vy ? Vy - Vx : Vx - Vy) + 1u;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        registers[Vx + step * static_cast<int>(i)] = memory[(index + i) & addressMask];
+    }
+}
+
+// Set I = nnnn, the 16-bit address in the two bytes after the instruction
+void Chip8::OP_F000() {
+    index = (memory[pc & addressMask] << 8u) | memory[(pc + 1u) & addressMask];
+
+    pc += 2;
+}
+
+// Select the planes that drawing, clearing and scrolling work on
+void Chip8::OP_Fn01() {
+    planeMask = ((opcode & 0x0F00u) >> 8u) & 0x3u;
+}
+
+// Load the 16-byte audio pattern from memory starting at location I
+void Chip8::OP_Fx02() {
+    for (unsigned int i = 0; i < sizeof(audioPattern); ++i) {
+        audioPattern[i] = memory[(index + i) & addressMask];
+    }
+}
+
+// Set I = location of the big sprite for digit Vx
+void Chip8::OP_Fx30() {
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t digit = registers[Vx] & 0xFu;
+
+    index = BIG_FONTSET_START_ADDRESS + (10 * digit);
+}
+
+// Set the audio pitch = Vx
+void Chip8::OP_Fx3A() {
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+
+    pitch = registers[Vx];
+}
+
+// Store V0 through Vx in the flag registers
+void Chip8::OP_Fx75() {
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+
+    memcpy(flags, registers, Vx + 1u);
+}
+
+// Read V0 through Vx from the flag registers
+void Chip8::OP_Fx85() {
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+
+    memcpy(registers, flags, Vx + 1u);
+}
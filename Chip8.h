@@ -7,45 +7,180 @@
 // Goal is to try to work on a more sophisticated emulator after this (NES?)
 //
 
-#include <chrono>
-#include <random>
+#include "Random.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #ifndef EMULATOR_CHIP_8_CHIP8_H
 #define EMULATOR_CHIP_8_CHIP8_H
 
 
-class Chip8 {
-public:
+const unsigned int VIDEO_WIDTH = 64;
+const unsigned int VIDEO_HEIGHT = 32;
+
+// Memory layout: programs load at 0x200 and the font sits at 0x50, with the SUPER-CHIP
+// big font right after it
+const unsigned int START_ADDRESS = 0x200;
+const unsigned int FONTSET_START_ADDRESS = 0x50;
+const unsigned int BIG_FONTSET_START_ADDRESS = 0xA0;
+const unsigned int MEMORY_SIZE = 4096;
 
-    Chip8();
+// The SUPER-CHIP and XO-CHIP display, and XO-CHIP's address space
+const unsigned int HIRES_WIDTH = 128;
+const unsigned int HIRES_HEIGHT = 64;
+const unsigned int PLANE_COUNT = 2;
+const unsigned int EXTENDED_MEMORY_SIZE = 65536;
 
-    ~Chip8();
+// Index of the lowest key that is down in a keypad mask; only meaningful when at least
+// one is
+inline unsigned int FirstKey(uint16_t keys) {
+#ifdef _MSC_VER
+    unsigned long key;
+    _BitScanForward(&key, keys);
+    return key;
+#else
+    return __builtin_ctz(keys);
+#endif
+}
 
+// DISPATCH ENGINES
+/* How Cycle() gets from a fetched opcode to the function that executes it.
+ *
+ * Table walks the function pointer tables: one indirect call through table[] on the
+ * first nibble, and for the 0, 8, E and F families a second indirect call through the
+ * matching sub-table.
+ *
+ * Switch decodes the whole opcode in a single nested switch and calls the OP_ functions
+ * directly, which lets the compiler inline them and turn the decode into jump tables it
+ * can lay out itself. Both engines execute the same OP_ functions, so they can be
+ * compared against each other for throughput.
+ *
+ * Cached fetches and decodes each address of program memory once and remembers the
+ * opcode together with the OP_ function it resolved to, so a loop that runs the same
+ * instructions over and over skips the fetch and both levels of table lookup.
+ *
+ * Recompiler translates straight-line runs of instructions (basic blocks) into a list of
+ * pre-resolved OP_ functions the first time the PC enters them, then runs a whole block
+ * per Cycle() without fetching, decoding or touching the PC until the instruction that
+ * ends it. A block ends at anything that can change the flow of the program (jumps,
+ * calls, returns, skips, waiting for a key) or store into memory (which could rewrite
+ * the block itself).
+ */
+enum class Dispatch {
+    Table,
+    Switch,
+    Cached,
+    Recompiler
+};
+
+// QUIRKS
+/* The instructions that interpreters never agreed on, and what each profile does with
+ * them. ROMs were written against one interpreter or another and many only run right
+ * with its quirks:
+ *
+ *  - shiftVy: OP_8xy6 and OP_8xyE shift Vy into Vx (COSMAC VIP) rather than Vx in place
+ *  - incrementIndex: OP_Fx55 and OP_Fx65 leave I pointing past the last register stored
+ *    or loaded (COSMAC VIP) rather than where it was
+ *  - jumpVx: OP_Bnnn jumps to nnn + Vx, x being the top nibble of nnn (SUPER-CHIP),
+ *    rather than nnn + V0
+ *  - wrapSprites: OP_Dxyn wraps sprites around the right and bottom edges (XO-CHIP)
+ *    rather than clipping them
+ *
+ * The SuperChip and XoChip profiles also bring their interpreters' extra instructions
+ * and display, see EXTENDED MODE below:
+ *
+ *  - superChip: the 128x64 display, scrolling, 16x16 sprites, the big font and the flag
+ *    registers
+ *  - xoChip: on top of that, 64KB of memory, two bit planes, scrolling up, storing and
+ *    loading register ranges, the four-byte F000 nnnn and the audio pattern registers
+ *
+ * Each profile is a set of compile-time constants the affected OP_ functions are
+ * instantiated with, so every profile gets its own copy of them with the quirks folded
+ * in and nothing is checked while running. Modern is what this interpreter has always
+ * done, and is the default.
+ */
+enum class Quirks {
+    Modern,
+    Cosmac,
+    SuperChip,
+    XoChip
+};
 
+struct ModernQuirks {
+    static constexpr bool shiftVy = false;
+    static constexpr bool incrementIndex = false;
+    static constexpr bool jumpVx = false;
+    static constexpr bool wrapSprites = false;
+    static constexpr bool superChip = false;
+    static constexpr bool xoChip = false;
+};
+
+struct CosmacQuirks {
+    static constexpr bool shiftVy = true;
+    static constexpr bool incrementIndex = true;
+    static constexpr bool jumpVx = false;
+    static constexpr bool wrapSprites = false;
+    static constexpr bool superChip = false;
+    static constexpr bool xoChip = false;
+};
+
+struct SuperChipQuirks {
+    static constexpr bool shiftVy = false;
+    static constexpr bool incrementIndex = false;
+    static constexpr bool jumpVx = true;
+    static constexpr bool wrapSprites = false;
+    static constexpr bool superChip = true;
+    static constexpr bool xoChip = false;
+};
 
+struct XoChipQuirks {
+    static constexpr bool shiftVy = true;
+    static constexpr bool incrementIndex = true;
+    static constexpr bool jumpVx = false;
+    static constexpr bool wrapSprites = true;
+    static constexpr bool superChip = true;
+    static constexpr bool xoChip = true;
+};
+
+// CPU STATE
+/* Everything an instruction reads or writes apart from memory and the display, packed
+ * into one 64-byte cache line (Chip8 inherits it, so it sits at the very start of the
+ * object). Executing an instruction then touches this one line plus whatever memory and
+ * display bytes the instruction itself uses, and the rest of the object can stay cold.
+ */
+struct alignas(64) Chip8Cpu {
     // 8-BIT REGISTERS
     /* A dedicated location on the cpu for storage. All operations that a CPU does
-    * must be done within its registers. CPU's typically only have a few registers,
-    * so long term data is held in memory instead. Operations often include loading
-    * data from memory into registers, operating on those registers, and then storing
-    * the result back into memory.
-    */
-    uint8_t registers[16]{};
-
-    // BYTES OF MEMORY
-    /* Since there is so little register-space, a computer needs a large chunk of
-     * general memory dedicated to holding program instructions, long term data,
-     * and short term data. Different locations in that memory are referenced using
-     * an address
+     * must be done within its registers. CPU's typically only have a few registers,
+     * so long term data is held in memory instead. Operations often include loading
+     * data from memory into registers, operating on those registers, and then storing
+     * the result back into memory.
      */
-    uint8_t memory[4096]{};
+    uint8_t registers[16]{};
 
-    // INDEX REGISTER
-    /* The Index Register is a special register used to store memory addresses for use in
-     * operations. It's a 16-bit register because the maximum memory address (0xFFF) is
-     * too big for an 8-bit register
+    // STACK
+    /* A stack is a way for a CPU to keep track of the order of execution when it calls
+     * into functions. There is an instruction (CALL) that will cause the CPU to begin
+     * executing instructions in a different region of the program. When the program
+     * reaches another instruction (RET), it must be able to go back to where it was
+     * when it hit the CALL instruction. The stack holds the PC value when the CALL
+     * instruction was executed, and the RETURN statement pulls that address from the
+     * stack and puts it back into the PC so the CPU will execute it on the next cycle.
+     *
+     * The CHIP-8 has 16 levels of stack, meaning it can hold 16 different PCs.
+     * Multiple levels allow for one function to call another function and so on, until
+     * they all return to the original caller site.
+     *
+     * Putting a PC onto the stack is called pushing, and pulling a PC off the stack is
+     * called popping.
      */
-    uint16_t index{};
+    uint16_t stack[16]{};
 
     // PROGRAM COUNTER
     /* The program instructions are stored in memory, starting at address 0x200.
@@ -64,23 +199,26 @@ public:
      */
     uint16_t pc{};
 
-    // STACK
-    /* A stack is a way for a CPU to keep track of the order of execution when it calls
-     * into functions. There is an instruction (CALL) that will cause the CPU to begin
-     * executing instructions in a different region of the program. When the program
-     * reaches another instruction (RET), it must be able to go back to where it was
-     * when it hit the CALL instruction. The stack holds the PC value when the CALL
-     * instruction was executed, and the RETURN statement pulls that address from the
-     * stack and puts it back into the PC so the CPU will execute it on the next cycle.
-     *
-     * The CHIP-8 has 16 levels of stack, meaning it can hold 16 different PCs.
-     * Multiple levels allow for one function to call another function and so on, until
-     * they all return to the original caller site.
+    // INDEX REGISTER
+    /* The Index Register is a special register used to store memory addresses for use in
+     * operations. It's a 16-bit register because the maximum memory address (0xFFF) is
+     * too big for an 8-bit register
+     */
+    uint16_t index{};
+
+    // The instruction being executed
+    uint16_t opcode{};
+
+    // INPUT KEYS
+    /* The CHIP-8 has 16 input keys that match the first 16 hex values: 0 through F. Each
+     * key is either pressed or not pressed.
      *
-     * Putting a PC onto the stack is called pushing, and pulling a PC off the stack is
-     * called popping.
+     * That makes the whole keypad fit in a 16-bit mask, one bit per key with key 0 in the
+     * lowest bit. "Is any key down" is then a compare against zero, "which key is down" is
+     * finding the lowest set bit, and saving or replaying input is copying two bytes.
+     * KeyPressed() and SetKey() look at and change a single key.
      */
-    uint16_t stack[16]{};
+    uint16_t keys{};
 
     // STACK POINTER
     /* Similar to how the PC is used to keep track of where in memory the CPU is executing,
@@ -101,8 +239,8 @@ public:
     /* The CHIP-8 has a simple timer used for timing. If the timer value is zero, it
      * stays zero. If it is loaded with a value, it will decrement at a rate of 60Hz.
      *
-     * Rather than making sure that the delay timer actually decrements at a rate of
-     * 60Hz, we just decrement it at whatever rate we have the cycle clock set to
+     * Cycle() leaves the timers alone; they count down in TickTimers(), which RunFrame()
+     * calls once per frame so they follow the 60Hz frame rate rather than the cycle clock.
      */
     uint8_t delayTimer{};
 
@@ -113,25 +251,143 @@ public:
      */
     uint8_t soundTimer{};
 
-    // INPUT KEYS
-    /* The CHIP-8 has 16 input keys that match the first 16 hex values: 0 through F. Each
-     * key is either pressed or not pressed.
+    // WAITING FOR A KEY
+    /* Set when OP_Fx0A finds no key pressed. The CPU is then blocked: RunFor() returns
+     * without executing anything until a key is down, and a frontend can sleep until its
+     * next input event instead of running the emulator at all.
+     */
+    bool waitingForKey{};
+
+    // IDLE LOOP
+    /* Set by OP_1nnn to the number of instructions in the loop it just closed, when that
+     * loop is one the program can't leave until a timer ticks or a key changes. RunFor()
+     * takes it from there, see IdleLoopLength().
+     */
+    uint8_t idleLoop{};
+};
+
+static_assert(sizeof(Chip8Cpu) == 64, "CPU state should fill exactly one cache line");
+
+class Chip8 : public Chip8Cpu {
+public:
+
+    explicit Chip8(Dispatch dispatch = Dispatch::Table, Quirks quirks = Quirks::Modern);
+
+    // memory can point into the Chip8 itself
+    Chip8(Chip8 const&) = delete;
+    Chip8& operator=(Chip8 const&) = delete;
+
+    // Back to the state of a newly constructed Chip8, with no ROM loaded and the
+    // generator seeded with 0, keeping the quirks and whatever the dispatch engine
+    // already allocated
+    void Reset();
+
+    // Switches every engine over to the given profile's OP_ functions. Comes before
+    // LoadROM(), since XO-CHIP ROMs are allowed to be bigger.
+    void SetQuirks(Quirks quirks);
+    Quirks GetQuirks() const { return quirks; }
+
+    // Whether the profile runs with the extended display, see EXTENDED MODE
+    bool Extended() const { return quirks == Quirks::SuperChip || quirks == Quirks::XoChip; }
+
+    // How much of memory the profile addresses; only XO-CHIP has more than 4KB
+    unsigned int MemorySize() const { return quirks == Quirks::XoChip ? EXTENDED_MEMORY_SIZE : MEMORY_SIZE; }
+
+    // The keypad, see Chip8Cpu::keys
+    bool KeyPressed(uint8_t key) const;
+    void SetKey(uint8_t key, bool pressed);
+    bool AnyKeyPressed() const;
+
+    // BYTES OF MEMORY
+    /* Since there is so little register-space, a computer needs a large chunk of
+     * general memory dedicated to holding program instructions, long term data,
+     * and short term data. Different locations in that memory are referenced using
+     * an address
+     *
+     * CHIP-8 programs see 4KB of it, kept inline as classicMemory. XO-CHIP's 64KB address
+     * space is only allocated when SetQuirks() switches to it, with memory pointing there
+     * instead, so the instructions don't need to know which one they're running with.
+     *
+     * Both sizes are powers of two, and every address an instruction makes up (from PC or
+     * I plus an offset) is masked with addressMask, so it wraps round to the start of
+     * memory instead of reaching past the end.
      */
-    uint8_t keypad[16]{};
+    uint8_t* memory = classicMemory;
+    unsigned int addressMask = MEMORY_SIZE - 1;
+    uint8_t classicMemory[MEMORY_SIZE]{};
+    std::unique_ptr<uint8_t[]> extendedMemory;
 
     // MONOCHROME DISPLAY MEMORY
     /* The CHIP-8 has an additional memory buffer used for storing the graphics to display.
      * It is 64 pixels wide and 32 pixels high. Each pixel is either on or off, so only two
      * colors can be represented.
+     *
+     * Since a pixel is a single bit and a row is exactly 64 of them, each row is stored as
+     * one 64-bit word with the leftmost pixel in the most significant bit. Drawing a sprite
+     * row is then a shift into place, an AND to detect collision and an XOR to draw it.
+     * Render() expands it into RGBA8888 pixels for whoever needs a texture.
+     */
+    uint64_t video[VIDEO_HEIGHT]{};
+
+    // DIRTY ROWS
+    /* Only OP_00E0 and OP_Dxyn change the display, and most frames run neither. They set
+     * the bit of every row they touched (bit 0 for the top row), so the frontend can tell
+     * whether anything changed since the last time it looked and clear it once it has
+     * presented the frame. It starts out all set so the very first frame is shown. On the
+     * extended display each bit stands for two rows.
+     */
+    uint32_t dirtyRows = 0xFFFFFFFFu;
+
+    // EXTENDED MODE
+    /* The SuperChip and XoChip profiles draw on a display of their own instead of video:
+     * 128x64 pixels in PLANE_COUNT bit planes, packed like video is, two 64-bit words per
+     * row with the leftmost pixel in the top bit of the first. In low resolution (the
+     * default, until OP_00FF) every pixel is drawn as a 2x2 block, so the frontend always
+     * gets the same 128x64 picture.
+     *
+     * Scrolling is then whole words moving: up and down move rows, and left and right
+     * shift each row's pair of words as one 128-bit value. Drawing lines a sprite row up
+     * with the pair the same way and collides and XORs it in two words.
+     *
+     * Instructions that draw, clear or scroll work on the planes selected by OP_Fn01; a
+     * SUPER-CHIP program only ever uses the first.
      */
-    uint32_t video[64*32]{};
+    uint64_t extendedVideo[PLANE_COUNT][HIRES_HEIGHT][2]{};
+    bool hires{};
+    uint8_t planeMask = 0x1;
 
-    uint16_t opcode;
+    // SUPER-CHIP's flag registers (OP_Fx75, OP_Fx85), and XO-CHIP's audio pattern and pitch
+    uint8_t flags[16]{};
+    uint8_t audioPattern[16]{};
+    uint8_t pitch = 64;
 
+    // DISPLAY VIEW
+    /* Where what's on screen right now is, for frontends: planes blocks of height rows,
+     * each row width / 64 words with the leftmost pixel in the top bit of the first word.
+     * That's video for the 64x32 display and extendedVideo for the extended one.
+     */
+    struct Display {
+        uint64_t const* rows;
+        unsigned int width;
+        unsigned int height;
+        unsigned int planes;
 
-    const unsigned int FONTSET_SIZE = 80;
+        size_t Words() const { return width / 64 * height * planes; }
+    };
 
-    uint8_t fontset[FONTSET_SIZE] = {
+    static const size_t MAX_DISPLAY_WORDS = PLANE_COUNT * HIRES_HEIGHT * 2;
+
+    Display Screen() const;
+
+    // FONT
+    /* The sprites for the hex digits 0 through F, 5 bytes each. They only ever get copied
+     * into memory, so one copy is shared by every Chip8 rather than carried in each.
+     */
+    static const unsigned int FONTSET_SIZE = 80;
+
+    static const unsigned int BIG_FONTSET_SIZE = 160;
+
+    static constexpr uint8_t fontset[FONTSET_SIZE] = {
             0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
             0x20, 0x60, 0x20, 0x20, 0x70, // 1
             0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -150,26 +406,158 @@ public:
             0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
 
-    std::default_random_engine randGen;
-    std::uniform_int_distribution<uint8_t> randByte;
+    // The 8x10 digits for OP_Fx30, 0 through F as Octo draws them
+    static constexpr uint8_t bigFontset[BIG_FONTSET_SIZE] = {
+            0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+            0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+            0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+            0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+            0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+            0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+            0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+            0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+            0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+            0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+            0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+            0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+            0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+            0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+            0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+            0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    // RANDOM NUMBERS
+    /* OP_Cxkk's generator, any of the ones in Random.h. It starts out seeded with 0, so
+     * two runs of the same ROM with the same input come out the same unless something
+     * calls Seed(). Its state is part of a save state.
+     */
+    typedef Pcg32 Random;
+
+    Random rng;
+
+    void Seed(uint64_t seed);
 
-    void LoadROM(char const* filename);
+    Dispatch dispatch;
+
+    // LOADING ROMS
+    /* ROMs are copied into memory starting at 0x200 in a single copy, either from a file
+     * (which is memory-mapped for the duration) or from bytes the caller already has, like
+     * a span out of a RomLibrary. A ROM that doesn't fit in the memory above 0x200, or a
+     * file that can't be opened, is refused and leaves memory as it was.
+     */
+    bool LoadROM(char const* filename);
+    bool LoadROM(uint8_t const* rom, size_t size);
     void Cycle();
+    void Render(uint32_t* pixels) const;
+    uint64_t VideoHash() const;
+
+    // SAVE STATES
+    /* A save state is a small versioned blob holding everything that makes up the state
+     * of the machine: registers, memory, index, PC, stack, timers, keypad, display and
+     * the random number generator. The display goes in packed (256 bytes), so a whole
+     * state is under 4.5KB and cheap enough to take every frame.
+     *
+     * The quirks profile is in there too, and loading a state switches to it. The extended
+     * profiles add their display and registers (about 2KB more), and XO-CHIP the rest of
+     * its 64KB of memory.
+     *
+     * SaveState() appends into a caller-owned buffer so snapshotting every frame doesn't
+     * have to allocate once the buffer has grown. LoadState() rejects anything that isn't
+     * a complete state of a version it knows, and leaves the machine untouched when it does.
+     */
+    void SaveState(std::vector<uint8_t>& state) const;
+    bool LoadState(uint8_t const* state, size_t size);
+
+    // BATCHED EXECUTION
+    /* RunFor() executes up to the given number of instructions back to back and returns
+     * how many actually ran (all of them, if it stopped early to wait for a key).
+     * RunFrame() does the same with one frame's worth of instructions and then ticks the
+     * timers, which makes it the call to use once per 60Hz frame. Neither one touches the
+     * timers per instruction; TickTimers() is where they count down, and it should be
+     * called 60 times a second.
+     *
+     * A program waiting for the next frame usually spins in a small loop: a jump to
+     * itself, or reading the delay timer until it hits zero, or checking a key. Neither
+     * the timers nor the keys can change in the middle of a batch, so once such a loop has
+     * gone round without changing anything it will keep doing that until the batch is
+     * over. RunFor() then counts all the trips it would have made as executed without
+     * making them, and only runs the few instructions that don't add up to a whole trip,
+     * so the machine ends up exactly where it would have anyway.
+     */
+    unsigned int RunFor(unsigned int cycles);
+    unsigned int RunFrame(unsigned int instructionsPerFrame);
+    void TickTimers();
+
+    // RunFor() with instrumentation, see Profiler.h
+    template <typename Profiler>
+    unsigned int RunProfiled(unsigned int cycles, Profiler& profiler);
+
+    // Instructions RunFor() counted as run without running them, inside idle loops or
+    // waiting on OP_Fx0A
+    uint64_t idleCycles = 0;
+
+    // Off makes OP_1nnn leave idle loops alone, so every instruction RunFor() counts was
+    // really run; for benchmarks, which time instructions rather than emulated time
+    bool skipIdleLoops = true;
+
+    // Sprites drawn with OP_Dxyn, for the metrics; a plain count, see Metrics.h
+    uint64_t spritesDrawn = 0;
+
+    // Instructions dispatched per family (the first nibble), for the metrics. What RunFor()
+    // counts without running anything, idle trips and batches given up to OP_Fx0A, isn't
+    // in them.
+    uint64_t familyCounts[16]{};
+
+    // Dispatch engines
+    void Fetch();
+    void CycleTable();
+    void CycleSwitch();
+    template <typename QuirksPolicy>
+    void CycleSwitch();
+    template <typename QuirksPolicy>
+    unsigned int RunSwitch(unsigned int cycles);
+    void CycleCached();
+    unsigned int CycleRecompiled(unsigned int budget);
+    unsigned int RunEngine(unsigned int cycles);
+
+    // Idle loop detection
+    static const unsigned int MAX_IDLE_LOOP = 8;
+    unsigned int IdleLoopLength(uint16_t start) const;
+
+    // Counts every whole trip round idleLoop that fits in remaining as run and clears it;
+    // returns what's left over, a part of a trip that still has to actually run
+    unsigned int SkipIdleTrips(unsigned int remaining);
+
+    // Everything RunFor() does around the engine loop, shared with RunProfiled() so the two
+    // can't drift apart; run(budget) runs up to budget instructions, stopping early at a
+    // blocking OP_Fx0A or an idle loop, and returns how many it ran
+    template <typename Run>
+    unsigned int RunBudget(unsigned int cycles, Run&& run);
+
+    // Decoded instruction cache
+    void PrepareCaches();
+    void InvalidateDecoded(uint16_t address, uint16_t count);
+    void InvalidateRange(unsigned int address, unsigned int count);
 
     // Tables
     void Table0();
+    void Table5();
     void Table8();
     void TableE();
     void TableF();
 
     // OP CODES
     void OP_NULL();
+    template <typename QuirksPolicy>
     void OP_00E0();
     void OP_00EE();
     void OP_1nnn();
     void OP_2nnn();
+    template <typename QuirksPolicy>
     void OP_3xkk();
+    template <typename QuirksPolicy>
     void OP_4xkk();
+    template <typename QuirksPolicy>
     void OP_5xy0();
     void OP_6xkk();
     void OP_7xkk();
@@ -179,15 +567,22 @@ public:
     void OP_8xy3();
     void OP_8xy4();
     void OP_8xy5();
+    template <typename QuirksPolicy>
     void OP_8xy6();
     void OP_8xy7();
+    template <typename QuirksPolicy>
     void OP_8xyE();
+    template <typename QuirksPolicy>
     void OP_9xy0();
     void OP_Annn();
+    template <typename QuirksPolicy>
     void OP_Bnnn();
     void OP_Cxkk();
+    template <typename QuirksPolicy>
     void OP_Dxyn();
+    template <typename QuirksPolicy>
     void OP_Ex9E();
+    template <typename QuirksPolicy>
     void OP_ExA1();
     void OP_Fx07();
     void OP_Fx0A();
@@ -196,11 +591,142 @@ public:
     void OP_Fx1E();
     void OP_Fx29();
     void OP_Fx33();
+    template <typename QuirksPolicy>
     void OP_Fx55();
+    template <typename QuirksPolicy>
     void OP_Fx65();
 
+    // SUPER-CHIP
+    void OP_00Cn();
+    void OP_00FB();
+    void OP_00FC();
+    void OP_00FD();
+    void OP_00FE();
+    void OP_00FF();
+    void OP_Fx30();
+    void OP_Fx75();
+    void OP_Fx85();
+
+    // XO-CHIP
+    void OP_00Dn();
+    void OP_5xy2();
+    void OP_5xy3();
+    void OP_F000();
+    void OP_Fn01();
+    void OP_Fx02();
+    void OP_Fx3A();
+
+    // The extended display's side of OP_00E0 and OP_Dxyn, and scrolling it
+    void ClearExtended();
+    template <typename QuirksPolicy>
+    void DrawExtended();
+    void ScrollVertical(int rows);
+    void ScrollHorizontal(int pixels);
+
+    // The PC past the next instruction, which is four bytes for XO-CHIP's F000 nnnn
+    template <typename QuirksPolicy>
+    void SkipNext();
+
+    typedef void (Chip8::*Chip8Func)();
+
+    // One full set of tables per quirks profile, indexed by Quirks
+    struct DispatchTables {
+        std::array<Chip8Func, 0xF + 1> table;
+        std::array<Chip8Func, 0xFF + 1> table0;
+        std::array<Chip8Func, 0xF + 1> table5;
+        std::array<Chip8Func, 0xF + 1> table8;
+        std::array<Chip8Func, 0xF + 1> tableE;
+        std::array<Chip8Func, 0xFF + 1> tableF;
+    };
+
+    static const DispatchTables dispatchTables[4];
+
+    Quirks quirks = Quirks::Modern;
+    DispatchTables const* tables = &dispatchTables[0];
+
+    Chip8Func Resolve(uint16_t instruction) const;
+
+    // The same for any profile's tables, which is how the profiler names what ran
+    static Chip8Func Resolve(DispatchTables const& tables, uint16_t instruction);
+
+    // DECODED INSTRUCTION CACHE
+    /* One entry per byte address from 0x200 up to the end of memory, holding the opcode
+     * stored there and the OP_ function that executes it. An empty handler means the
+     * address hasn't been decoded yet (or was written to since), and it is filled in the
+     * first time the PC lands on it.
+     *
+     * Entries go stale as soon as the memory under them changes, so anything that stores
+     * into memory has to call InvalidateDecoded() for the bytes it wrote, given I as it
+     * was; it wraps the range the same way the stores do. Inside the interpreter that is
+     * OP_Fx33, OP_Fx55 and OP_5xy2; code writing into memory from the outside has to do
+     * the same. It is only allocated for Dispatch::Cached, the first time it runs.
+     */
+    struct DecodedInstruction {
+        Chip8Func handler;
+        uint16_t opcode;
+    };
+
+    std::unique_ptr<DecodedInstruction[]> decoded;
+
+    // BASIC BLOCKS
+    /* A block is the straight-line run of instructions starting at an address, up to and
+     * including the first one that may branch or store. The PC is only brought up to date
+     * right before that last instruction, since it is the only one that can look at it.
+     *
+     * Blocks are kept per start address and share the invalidation of the decoded cache:
+     * a store into [start, end) of any block throws the block away so it is recompiled
+     * from the new memory next time. Only allocated for Dispatch::Recompiler, the first
+     * time it runs.
+     */
+    static const unsigned int MAX_BLOCK_LENGTH = 32;
+
+    struct Block {
+        uint16_t start;
+        uint16_t end;
+        uint8_t length;
+        DecodedInstruction ops[MAX_BLOCK_LENGTH];
+    };
+
+    std::unique_ptr<Block> Compile(uint16_t address) const;
 
+    std::unique_ptr<std::unique_ptr<Block>[]> blocks;
 };
 
+template <typename Run>
+unsigned int Chip8::RunBudget(unsigned int cycles, Run&& run) {
+    /* Once OP_Fx0A blocks, nothing the program does can change until a key goes down, so
+     * the rest of the batch is given up straight away rather than spinning on the wait.
+     * It still counts as spent: the budget is time, and the CPU spent that time waiting.
+     */
+    if (waitingForKey) {
+        if (!AnyKeyPressed()) {
+            idleCycles += cycles;
+            return cycles;
+        }
+
+        // OP_Fx0A left the PC on itself, so it runs again and picks up the key
+        waitingForKey = false;
+    }
+
+    PrepareCaches();
+
+    idleLoop = 0;
+
+    unsigned int executed = run(cycles);
+
+    if (idleLoop) {
+        unsigned int partial = SkipIdleTrips(cycles - executed);
+
+        executed = cycles - partial + run(partial);
+    }
+
+    if (waitingForKey) {
+        idleCycles += cycles - executed;
+        return cycles;
+    }
+
+    return executed;
+}
+
 
 #endif //EMULATOR_CHIP_8_CHIP8_H
@@ -0,0 +1,450 @@
+//
+// Many CHIP-8 machines running the same ROM in lockstep, stored structure-of-arrays.
+//
+
+#include "Chip8Lanes.h"
+#include <algorithm>
+#include <cstring>
+
+Chip8Lanes::Chip8Lanes(size_t laneCount)
+    : laneCount(laneCount),
+      registers(16 * laneCount),
+      stack(16 * laneCount),
+      pc(laneCount),
+      index(laneCount),
+      keys(laneCount),
+      sp(laneCount),
+      delayTimer(laneCount),
+      soundTimer(laneCount),
+      waitingForKey(laneCount),
+      memory(MEMORY_SIZE * laneCount),
+      video(VIDEO_HEIGHT * laneCount),
+      rng(laneCount),
+      written(MEMORY_SIZE) {
+    Reset();
+}
+
+void Chip8Lanes::Reset() {
+    std::fill(registers.begin(), registers.end(), 0);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(pc.begin(), pc.end(), START_ADDRESS);
+    std::fill(index.begin(), index.end(), 0);
+    std::fill(keys.begin(), keys.end(), 0);
+    std::fill(sp.begin(), sp.end(), 0);
+    std::fill(delayTimer.begin(), delayTimer.end(), 0);
+    std::fill(soundTimer.begin(), soundTimer.end(), 0);
+    std::fill(waitingForKey.begin(), waitingForKey.end(), 0);
+    std::fill(memory.begin(), memory.end(), 0);
+    std::fill(video.begin(), video.end(), 0);
+    std::fill(written.begin(), written.end(), 0);
+
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        memcpy(Memory(lane) + FONTSET_START_ADDRESS, Chip8::fontset, Chip8::FONTSET_SIZE);
+        rng[lane].Seed(0);
+    }
+}
+
+bool Chip8Lanes::LoadROM(uint8_t const* rom, size_t size) {
+    if (size > MEMORY_SIZE - START_ADDRESS) {
+        return false;
+    }
+
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        memcpy(Memory(lane) + START_ADDRESS, rom, size);
+    }
+
+    return true;
+}
+
+void Chip8Lanes::Seed(size_t lane, uint64_t seed) {
+    rng[lane].Seed(seed);
+}
+
+void Chip8Lanes::SetKeys(size_t lane, uint16_t laneKeys) {
+    keys[lane] = laneKeys;
+}
+
+uint16_t Chip8Lanes::Fetch(size_t lane) const {
+    uint8_t const* laneMemory = &memory[lane * MEMORY_SIZE];
+
+    return (laneMemory[pc[lane] & 0xFFFu] << 8u) | laneMemory[(pc[lane] + 1u) & 0xFFFu];
+}
+
+bool Chip8Lanes::Converged() const {
+    /* Checked before every instruction, so this has to be cheaper than the instruction.
+     * The PCs and wait flags are folded together without branching so the loop
+     * vectorizes. Only if some lane has stored to the bytes at the PC can the opcode
+     * there differ between lanes, and only then is every lane's opcode fetched.
+     */
+    unsigned int differ = 0;
+
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        differ |= (pc[lane] ^ pc[0]) | waitingForKey[lane];
+    }
+
+    if (differ) {
+        return false;
+    }
+
+    if (!written[pc[0] & 0xFFFu] && !written[(pc[0] + 1u) & 0xFFFu]) {
+        return true;
+    }
+
+    uint16_t opcode = Fetch(0);
+
+    for (size_t lane = 1; lane < laneCount; ++lane) {
+        if (Fetch(lane) != opcode) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+unsigned int Chip8Lanes::RunFor(unsigned int cycles) {
+    // A key that went down since last time releases its lane from OP_Fx0A, which runs again
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        if (waitingForKey[lane] && keys[lane]) {
+            waitingForKey[lane] = 0;
+        }
+    }
+
+    for (unsigned int executed = 0; executed < cycles; ++executed) {
+        if (Converged()) {
+            uint16_t opcode = Fetch(0);
+
+            for (size_t lane = 0; lane < laneCount; ++lane) {
+                pc[lane] += 2;
+            }
+
+            Execute(opcode, 0, laneCount);
+            ++lockstepSteps;
+            continue;
+        }
+
+        bool running = false;
+
+        for (size_t lane = 0; lane < laneCount; ++lane) {
+            if (waitingForKey[lane]) {
+                continue;
+            }
+
+            uint16_t opcode = Fetch(lane);
+            pc[lane] += 2;
+
+            Execute(opcode, lane, lane + 1);
+            running = true;
+        }
+
+        // Every lane is waiting for a key, and nothing can change that until RunFor() ends
+        if (!running) {
+            break;
+        }
+
+        ++divergentSteps;
+    }
+
+    return cycles;
+}
+
+void Chip8Lanes::TickTimers() {
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        delayTimer[lane] -= delayTimer[lane] > 0;
+        soundTimer[lane] -= soundTimer[lane] > 0;
+    }
+}
+
+void Chip8Lanes::CopyTo(size_t lane, Chip8& chip8) const {
+    for (unsigned int r = 0; r < 16; ++r) {
+        chip8.registers[r] = registers[r * laneCount + lane];
+        chip8.stack[r] = stack[r * laneCount + lane];
+    }
+
+    memcpy(chip8.memory, &memory[lane * MEMORY_SIZE], MEMORY_SIZE);
+    memcpy(chip8.video, &video[lane * VIDEO_HEIGHT], sizeof(chip8.video));
+
+    chip8.pc = pc[lane];
+    chip8.index = index[lane];
+    chip8.keys = keys[lane];
+    chip8.sp = sp[lane];
+    chip8.delayTimer = delayTimer[lane];
+    chip8.soundTimer = soundTimer[lane];
+    chip8.waitingForKey = waitingForKey[lane] != 0;
+    chip8.rng.SetState(rng[lane].State());
+
+    chip8.InvalidateDecoded(START_ADDRESS, MEMORY_SIZE - START_ADDRESS);
+    chip8.dirtyRows = 0xFFFFFFFFu;
+}
+
+void Chip8Lanes::Execute(uint16_t opcode, size_t first, size_t last) {
+    /* Every case is a loop over the lanes doing what the matching Chip8::OP_ function does,
+     * statement for statement, so a lane ends up exactly where a Chip8 would even when the
+     * registers involved overlap (x or y being F, say). Addresses are wrapped to the 4KB of
+     * a lane's memory so a stray index can't reach into the next lane.
+     */
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    uint8_t byte = opcode & 0x00FFu;
+    uint16_t address = opcode & 0x0FFFu;
+
+    uint8_t* x = Register(Vx);
+    uint8_t* y = Register(Vy);
+    uint8_t* f = Register(0xF);
+
+    switch (opcode >> 12u) {
+        case 0x0:
+            // Decoded on the low nibble like Table0 does
+            if ((opcode & 0x000Fu) == 0x0u) {
+                for (size_t lane = first; lane < last; ++lane) {
+                    memset(&video[lane * VIDEO_HEIGHT], 0, VIDEO_HEIGHT * sizeof(uint64_t));
+                }
+            } else if ((opcode & 0x000Fu) == 0xEu) {
+                for (size_t lane = first; lane < last; ++lane) {
+                    --sp[lane];
+                    pc[lane] = StackLevel(sp[lane])[lane];
+                }
+            }
+            break;
+
+        case 0x1:
+            for (size_t lane = first; lane < last; ++lane) {
+                pc[lane] = address;
+            }
+            break;
+
+        case 0x2:
+            for (size_t lane = first; lane < last; ++lane) {
+                StackLevel(sp[lane])[lane] = pc[lane];
+                ++sp[lane];
+                pc[lane] = address;
+            }
+            break;
+
+        case 0x3:
+            for (size_t lane = first; lane < last; ++lane) {
+                pc[lane] += x[lane] == byte ? 2 : 0;
+            }
+            break;
+
+        case 0x4:
+            for (size_t lane = first; lane < last; ++lane) {
+                pc[lane] += x[lane] != byte ? 2 : 0;
+            }
+            break;
+
+        case 0x5:
+            for (size_t lane = first; lane < last; ++lane) {
+                pc[lane] += x[lane] == y[lane] ? 2 : 0;
+            }
+            break;
+
+        case 0x6:
+            for (size_t lane = first; lane < last; ++lane) {
+                x[lane] = byte;
+            }
+            break;
+
+        case 0x7:
+            for (size_t lane = first; lane < last; ++lane) {
+                x[lane] += byte;
+            }
+            break;
+
+        case 0x8:
+            switch (opcode & 0x000Fu) {
+                case 0x0:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        x[lane] = y[lane];
+                    }
+                    break;
+                case 0x1:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        x[lane] |= y[lane];
+                    }
+                    break;
+                case 0x2:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        x[lane] &= y[lane];
+                    }
+                    break;
+                case 0x3:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        x[lane] ^= y[lane];
+                    }
+                    break;
+                case 0x4:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        uint16_t sum = x[lane] + y[lane];
+                        f[lane] = sum > 255u;
+                        x[lane] = sum & 0xFFu;
+                    }
+                    break;
+                case 0x5:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        f[lane] = x[lane] > y[lane];
+                        x[lane] -= y[lane];
+                    }
+                    break;
+                case 0x6:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        f[lane] = x[lane] & 0x1u;
+                        x[lane] >>= 1;
+                    }
+                    break;
+                case 0x7:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        f[lane] = y[lane] > x[lane];
+                        x[lane] = y[lane] - x[lane];
+                    }
+                    break;
+                case 0xE:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        f[lane] = (x[lane] & 0x80u) >> 7u;
+                        x[lane] <<= 1;
+                    }
+                    break;
+            }
+            break;
+
+        case 0x9:
+            for (size_t lane = first; lane < last; ++lane) {
+                pc[lane] += x[lane] != y[lane] ? 2 : 0;
+            }
+            break;
+
+        case 0xA:
+            for (size_t lane = first; lane < last; ++lane) {
+                index[lane] = address;
+            }
+            break;
+
+        case 0xB: {
+            uint8_t* v0 = Register(0);
+
+            for (size_t lane = first; lane < last; ++lane) {
+                pc[lane] = v0[lane] + address;
+            }
+        } break;
+
+        case 0xC:
+            for (size_t lane = first; lane < last; ++lane) {
+                x[lane] = rng[lane].NextByte() & byte;
+            }
+            break;
+
+        case 0xD: {
+            // Same drawing as Chip8::OP_Dxyn, one lane's display at a time
+            uint8_t height = opcode & 0x000Fu;
+
+            for (size_t lane = first; lane < last; ++lane) {
+                uint8_t const* laneMemory = Memory(lane);
+                uint64_t* laneVideo = &video[lane * VIDEO_HEIGHT];
+
+                uint8_t xPos = x[lane] % VIDEO_WIDTH;
+                uint8_t yPos = y[lane] % VIDEO_HEIGHT;
+
+                f[lane] = 0;
+
+                for (unsigned int row = 0; row < height && yPos + row < VIDEO_HEIGHT; ++row) {
+                    uint64_t spriteRow = (static_cast<uint64_t>(laneMemory[(index[lane] + row) & 0xFFFu]) << 56u) >> xPos;
+                    uint64_t& screenRow = laneVideo[yPos + row];
+
+                    if (screenRow & spriteRow) {
+                        f[lane] = 1;
+                    }
+
+                    screenRow ^= spriteRow;
+                }
+            }
+        } break;
+
+        case 0xE:
+            if ((opcode & 0x000Fu) == 0xEu) {
+                for (size_t lane = first; lane < last; ++lane) {
+                    pc[lane] += (keys[lane] >> (x[lane] & 0xFu)) & 0x1u ? 2 : 0;
+                }
+            } else if ((opcode & 0x000Fu) == 0x1u) {
+                for (size_t lane = first; lane < last; ++lane) {
+                    pc[lane] += (keys[lane] >> (x[lane] & 0xFu)) & 0x1u ? 0 : 2;
+                }
+            }
+            break;
+
+        case 0xF:
+            switch (byte) {
+                case 0x07:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        x[lane] = delayTimer[lane];
+                    }
+                    break;
+                case 0x0A:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        if (keys[lane]) {
+                            x[lane] = FirstKey(keys[lane]);
+                        } else {
+                            pc[lane] -= 2;
+                            waitingForKey[lane] = 1;
+                        }
+                    }
+                    break;
+                case 0x15:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        delayTimer[lane] = x[lane];
+                    }
+                    break;
+                case 0x18:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        soundTimer[lane] = x[lane];
+                    }
+                    break;
+                case 0x1E:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        index[lane] += x[lane];
+                    }
+                    break;
+                case 0x29:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        index[lane] = FONTSET_START_ADDRESS + (5 * x[lane]);
+                    }
+                    break;
+                case 0x33:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        uint8_t* laneMemory = Memory(lane);
+                        uint8_t value = x[lane];
+
+                        laneMemory[(index[lane] + 2u) & 0xFFFu] = value % 10;
+                        value /= 10;
+
+                        laneMemory[(index[lane] + 1u) & 0xFFFu] = value % 10;
+                        value /= 10;
+
+                        laneMemory[index[lane] & 0xFFFu] = value % 10;
+
+                        for (unsigned int i = 0; i < 3; ++i) {
+                            written[(index[lane] + i) & 0xFFFu] = 1;
+                        }
+                    }
+                    break;
+                case 0x55:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        uint8_t* laneMemory = Memory(lane);
+
+                        for (uint8_t i = 0; i <= Vx; ++i) {
+                            laneMemory[(index[lane] + i) & 0xFFFu] = Register(i)[lane];
+                            written[(index[lane] + i) & 0xFFFu] = 1;
+                        }
+                    }
+                    break;
+                case 0x65:
+                    for (size_t lane = first; lane < last; ++lane) {
+                        uint8_t const* laneMemory = Memory(lane);
+
+                        for (uint8_t i = 0; i <= Vx; ++i) {
+                            Register(i)[lane] = laneMemory[(index[lane] + i) & 0xFFFu];
+                        }
+                    }
+                    break;
+            }
+            break;
+    }
+}
@@ -0,0 +1,100 @@
+//
+// Many CHIP-8 machines running the same ROM in lockstep, stored structure-of-arrays.
+//
+
+#include "Chip8.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_CHIP8LANES_H
+#define EMULATOR_CHIP_8_CHIP8LANES_H
+
+
+// LOCKSTEP LANES
+/* Fuzzing and compatibility sweeps run one ROM many times over with different seeds and
+ * input. Those machines spend most of their time at the same PC running the same
+ * instruction, just on different data, so here each piece of state is one array with an
+ * element per machine (a lane): V3 of every lane is one contiguous run of bytes, and so
+ * is every lane's PC, timer and so on.
+ *
+ * When every lane is at the same PC with the same opcode, the instruction is decoded
+ * once and executed across all lanes in a single loop over those arrays, which the
+ * compiler turns into vector instructions for the register operations (OP_7xkk is a
+ * byte-wise vector add, OP_8xy4 an add plus a compare, the skips a compare and a masked
+ * add on the PCs). As soon as the lanes disagree, each one is fetched, decoded and run
+ * on its own until they line up again.
+ *
+ * Lanes behave exactly like a Chip8 running on its own with the same seed and keys,
+ * programs that go out of range included: addresses wrap round 4KB of memory and stack
+ * levels round sixteen, as they do in Chip8 (tests/Chip8LanesTest.cpp checks the two
+ * against each other). CopyTo() puts a lane into a Chip8 to look at it, render it or
+ * save it. Memory and the display are kept per lane in one block each, since those are
+ * addressed per lane anyway.
+ *
+ * Lanes always run the Modern quirks profile; a ROM that needs another one has to run on
+ * Chip8s set up with it.
+ */
+class Chip8Lanes {
+public:
+    explicit Chip8Lanes(size_t laneCount);
+
+    size_t Lanes() const { return laneCount; }
+
+    // Every lane back to power-on, like Chip8::Reset()
+    void Reset();
+
+    // The same ROM into every lane
+    bool LoadROM(uint8_t const* rom, size_t size);
+
+    void Seed(size_t lane, uint64_t seed);
+    void SetKeys(size_t lane, uint16_t keys);
+
+    // Runs every lane for the given number of instructions; like Chip8::RunFor(), a lane
+    // that blocks on OP_Fx0A spends the rest of its budget waiting
+    unsigned int RunFor(unsigned int cycles);
+    void TickTimers();
+
+    void CopyTo(size_t lane, Chip8& chip8) const;
+
+    // Instruction steps taken with all lanes together, and one lane at a time
+    uint64_t LockstepSteps() const { return lockstepSteps; }
+    uint64_t DivergentSteps() const { return divergentSteps; }
+
+private:
+    uint8_t* Register(unsigned int r) { return &registers[r * laneCount]; }
+    uint16_t* StackLevel(unsigned int level) { return &stack[(level & 0xFu) * laneCount]; }
+    uint8_t* Memory(size_t lane) { return &memory[lane * MEMORY_SIZE]; }
+
+    uint16_t Fetch(size_t lane) const;
+    bool Converged() const;
+
+    // Executes one already fetched opcode on the lanes [first, last)
+    void Execute(uint16_t opcode, size_t first, size_t last);
+
+    size_t laneCount;
+
+    std::vector<uint8_t> registers;
+    std::vector<uint16_t> stack;
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> index;
+    std::vector<uint16_t> keys;
+    std::vector<uint8_t> sp;
+    std::vector<uint8_t> delayTimer;
+    std::vector<uint8_t> soundTimer;
+    std::vector<uint8_t> waitingForKey;
+
+    std::vector<uint8_t> memory;
+    std::vector<uint64_t> video;
+    std::vector<Chip8::Random> rng;
+
+    // Every address any lane has stored to since Reset(), the only places where lanes'
+    // memory can differ
+    std::vector<uint8_t> written;
+
+    uint64_t lockstepSteps{};
+    uint64_t divergentSteps{};
+};
+
+
+#endif //EMULATOR_CHIP_8_CHIP8LANES_H
@@ -0,0 +1,45 @@
+//
+// Recycles Chip8 instances between jobs instead of allocating a new one each time.
+//
+
+#include "Chip8Pool.h"
+
+Chip8Pool::Chip8Pool(Dispatch dispatch)
+    : dispatch(dispatch) {
+}
+
+std::unique_ptr<Chip8> Chip8Pool::Acquire() {
+    std::unique_ptr<Chip8> chip8;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (free.empty()) {
+            ++allocated;
+        } else {
+            chip8 = std::move(free.back());
+            free.pop_back();
+        }
+    }
+
+    // Resetting happens outside the lock, it's the slow part
+    if (chip8) {
+        chip8->Reset();
+    } else {
+        chip8.reset(new Chip8(dispatch));
+    }
+
+    return chip8;
+}
+
+void Chip8Pool::Release(std::unique_ptr<Chip8> chip8) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    free.push_back(std::move(chip8));
+}
+
+size_t Chip8Pool::Allocated() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return allocated;
+}
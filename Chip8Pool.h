@@ -0,0 +1,40 @@
+//
+// Recycles Chip8 instances between jobs instead of allocating a new one each time.
+//
+
+#include "Chip8.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_CHIP8POOL_H
+#define EMULATOR_CHIP_8_CHIP8POOL_H
+
+
+// CHIP8 POOL
+/* Acquire() hands out a Chip8 in its power-on state, reusing a released one if there is
+ * one and only allocating when there isn't. Released instances are handed out again
+ * last-in first-out, so a worker that releases one and acquires right away gets the one
+ * it was just using back, still in its cache, along with the decoded cache or compiled
+ * blocks the engine had already allocated. Safe to use from any number of threads.
+ */
+class Chip8Pool {
+public:
+    explicit Chip8Pool(Dispatch dispatch = Dispatch::Table);
+
+    std::unique_ptr<Chip8> Acquire();
+    void Release(std::unique_ptr<Chip8> chip8);
+
+    // How many instances were ever created
+    size_t Allocated() const;
+
+private:
+    Dispatch dispatch;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Chip8>> free;
+    size_t allocated{};
+};
+
+
+#endif //EMULATOR_CHIP_8_CHIP8POOL_H
@@ -0,0 +1,86 @@
+//
+// XOR deltas between two equally sized blobs, coded as runs of unchanged and changed bytes.
+//
+
+#include "DeltaCoding.h"
+
+// A literal run in a delta only ends at this many unchanged bytes in a row; shorter gaps
+// cost more as a new run header than as literal zeros
+const size_t MIN_ZERO_RUN = 3;
+
+void PutVarint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80u) {
+        out.push_back(static_cast<uint8_t>(value | 0x80u));
+        value >>= 7u;
+    }
+
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+size_t GetVarint(uint8_t const*& in) {
+    size_t value = 0;
+
+    for (unsigned int shift = 0;; shift += 7u) {
+        uint8_t byte = *in++;
+        value |= static_cast<size_t>(byte & 0x7Fu) << shift;
+
+        if (!(byte & 0x80u)) {
+            return value;
+        }
+    }
+}
+
+void EncodeDelta(uint8_t const* base, uint8_t const* current, size_t size, std::vector<uint8_t>& delta) {
+    size_t position = 0;
+
+    while (position < size) {
+        size_t literalStart = position;
+
+        while (literalStart < size && base[literalStart] == current[literalStart]) {
+            ++literalStart;
+        }
+
+        if (literalStart == size) {
+            break;
+        }
+
+        size_t literalEnd = literalStart;
+
+        while (literalEnd < size) {
+            size_t unchanged = literalEnd;
+
+            while (unchanged < size && unchanged - literalEnd < MIN_ZERO_RUN && base[unchanged] == current[unchanged]) {
+                ++unchanged;
+            }
+
+            if (unchanged - literalEnd >= MIN_ZERO_RUN || unchanged == size) {
+                break;
+            }
+
+            literalEnd = unchanged + 1;
+        }
+
+        PutVarint(delta, literalStart - position);
+        PutVarint(delta, literalEnd - literalStart);
+
+        for (size_t i = literalStart; i < literalEnd; ++i) {
+            delta.push_back(base[i] ^ current[i]);
+        }
+
+        position = literalEnd;
+    }
+}
+
+void DecodeDelta(uint8_t const* delta, size_t size, uint8_t* current) {
+    uint8_t const* end = delta + size;
+    size_t position = 0;
+
+    while (delta < end) {
+        position += GetVarint(delta);
+        size_t literals = GetVarint(delta);
+
+        for (size_t i = 0; i < literals; ++i) {
+            current[position++] ^= *delta++;
+        }
+    }
+}
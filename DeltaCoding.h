@@ -0,0 +1,32 @@
+//
+// XOR deltas between two equally sized blobs, coded as runs of unchanged and changed bytes.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_DELTACODING_H
+#define EMULATOR_CHIP_8_DELTACODING_H
+
+
+// VARINTS
+/* Seven bits per byte, lowest first, with the top bit set on every byte but the last, so
+ * the small counts that make up most of a delta take a single byte.
+ */
+void PutVarint(std::vector<uint8_t>& out, size_t value);
+size_t GetVarint(uint8_t const*& in);
+
+// DELTAS
+/* A delta is a list of (unchanged count, literal count, literal bytes) runs, where the
+ * literal bytes are the XOR of base and current. Trailing unchanged bytes are left off,
+ * so two identical blobs give an empty delta.
+ *
+ * EncodeDelta() appends to delta. DecodeDelta() applies size bytes of delta to the blob
+ * it was made against, in place, which turns it into the other one.
+ */
+void EncodeDelta(uint8_t const* base, uint8_t const* current, size_t size, std::vector<uint8_t>& delta);
+void DecodeDelta(uint8_t const* delta, size_t size, uint8_t* current);
+
+
+#endif //EMULATOR_CHIP_8_DELTACODING_H
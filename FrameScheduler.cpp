@@ -0,0 +1,76 @@
+//
+// Paces the main loop at a fixed frame rate by sleeping instead of spinning.
+//
+
+#include "FrameScheduler.h"
+#include <thread>
+
+// Sleeping is only trusted to get this close to the deadline, the rest is spun out
+const std::chrono::microseconds SPIN_THRESHOLD(1500);
+
+FrameScheduler::FrameScheduler(uint64_t instructionsPerSecond, unsigned int framesPerSecond)
+    : frameTime(std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / framesPerSecond),
+      nextFrameTime(Clock::now()),
+      instructionsPerSecond(instructionsPerSecond),
+      framesPerSecond(framesPerSecond) {
+}
+
+void FrameScheduler::WaitForNextFrame() {
+    if (Clock::now() < nextFrameTime - SPIN_THRESHOLD) {
+        std::this_thread::sleep_until(nextFrameTime - SPIN_THRESHOLD);
+    }
+
+    while (Clock::now() < nextFrameTime) {
+        std::this_thread::yield();
+    }
+
+    Clock::time_point wakeTime = Clock::now();
+    Clock::duration jitter = wakeTime - nextFrameTime;
+
+    ++frames;
+    totalJitter += jitter;
+
+    if (jitter > maxJitter) {
+        maxJitter = jitter;
+    }
+
+    nextFrameTime += frameTime;
+
+    // Too far behind to catch up, start over from now
+    if (nextFrameTime < wakeTime) {
+        ++droppedFrames;
+        nextFrameTime = wakeTime + frameTime;
+    }
+}
+
+unsigned int FrameScheduler::InstructionsThisFrame() {
+    // The instructions due by the end of this frame minus those due by the end of the last
+    uint64_t due = (budgetFrame + 1) * instructionsPerSecond / framesPerSecond;
+    uint64_t done = budgetFrame * instructionsPerSecond / framesPerSecond;
+
+    budgetFrame = (budgetFrame + 1) % framesPerSecond;
+
+    return static_cast<unsigned int>(due - done);
+}
+
+int FrameScheduler::MillisecondsUntilNextFrame() const {
+    Clock::duration remaining = nextFrameTime - Clock::now();
+
+    if (remaining <= Clock::duration::zero()) {
+        return 0;
+    }
+
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count());
+}
+
+double FrameScheduler::MeanJitterMicroseconds() const {
+    if (frames == 0) {
+        return 0.0;
+    }
+
+    return std::chrono::duration<double, std::micro>(totalJitter).count() / frames;
+}
+
+double FrameScheduler::MaxJitterMicroseconds() const {
+    return std::chrono::duration<double, std::micro>(maxJitter).count();
+}
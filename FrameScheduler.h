@@ -0,0 +1,59 @@
+//
+// Paces the main loop at a fixed frame rate by sleeping instead of spinning.
+//
+
+#include <chrono>
+#include <cstdint>
+
+#ifndef EMULATOR_CHIP_8_FRAMESCHEDULER_H
+#define EMULATOR_CHIP_8_FRAMESCHEDULER_H
+
+
+// FRAME SCHEDULER
+/* Hands out frame deadlines at a fixed rate (60 a second by default) and puts the thread
+ * to sleep until the next one. The OS only wakes sleepers to within a millisecond or so,
+ * so the sleep stops short of the deadline and the last stretch is spent yielding until
+ * it actually arrives.
+ *
+ * It also splits an instructions-per-second target into per-frame batches, carrying the
+ * remainder along so a rate that isn't a multiple of the frame rate still comes out
+ * exact over a second.
+ *
+ * Jitter is how late each wakeup was relative to its deadline. A frame that starts more
+ * than a whole frame late is counted as dropped, and the schedule restarts from now
+ * instead of trying to catch up on every missed frame at once.
+ */
+class FrameScheduler {
+public:
+    explicit FrameScheduler(uint64_t instructionsPerSecond, unsigned int framesPerSecond = 60);
+
+    void WaitForNextFrame();
+
+    unsigned int InstructionsThisFrame();
+
+    // Time left until the next deadline, rounded down, for handing to other waits
+    int MillisecondsUntilNextFrame() const;
+
+    uint64_t Frames() const { return frames; }
+    uint64_t DroppedFrames() const { return droppedFrames; }
+    double MeanJitterMicroseconds() const;
+    double MaxJitterMicroseconds() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::duration frameTime;
+    Clock::time_point nextFrameTime;
+
+    uint64_t instructionsPerSecond;
+    unsigned int framesPerSecond;
+    uint64_t budgetFrame{};
+
+    uint64_t frames{};
+    uint64_t droppedFrames{};
+    Clock::duration totalJitter{};
+    Clock::duration maxJitter{};
+};
+
+
+#endif //EMULATOR_CHIP_8_FRAMESCHEDULER_H
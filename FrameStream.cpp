@@ -0,0 +1,411 @@
+//
+// Streams the display out as compact encoded frames, to a file or a socket, from a thread
+// of its own.
+//
+
+#include "FrameStream.h"
+#include "DeltaCoding.h"
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+// How long the writer sleeps at most before looking at the queue again, in case a wake-up
+// from Push() slipped past it
+const auto WRITER_WAIT = std::chrono::milliseconds(5);
+
+// FILE SINK
+
+FileSink::~FileSink() {
+    if (file) {
+        std::fclose(file);
+    }
+}
+
+bool FileSink::Open(char const* filename) {
+    file = std::fopen(filename, "wb");
+
+    return file != nullptr;
+}
+
+bool FileSink::Write(uint8_t const* data, size_t size) {
+    return std::fwrite(data, 1, size, file) == size;
+}
+
+// SOCKET SINK
+
+#ifdef _WIN32
+
+SocketSink::~SocketSink() {
+    if (connection != INVALID_SOCKET) {
+        closesocket(connection);
+    }
+}
+
+bool SocketSink::Connect(std::string const& host, std::string const& port) {
+    WSADATA data;
+
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        return false;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+
+    for (addrinfo* address = addresses; address; address = address->ai_next) {
+        SOCKET candidate = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+        if (candidate == INVALID_SOCKET) {
+            continue;
+        }
+
+        if (connect(candidate, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0) {
+            connection = candidate;
+            break;
+        }
+
+        closesocket(candidate);
+    }
+
+    freeaddrinfo(addresses);
+
+    return connection != INVALID_SOCKET;
+}
+
+bool SocketSink::Write(uint8_t const* data, size_t size) {
+    while (size) {
+        int sent = send(connection, reinterpret_cast<char const*>(data), static_cast<int>(size), 0);
+
+        if (sent <= 0) {
+            return false;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+#else
+
+SocketSink::~SocketSink() {
+    if (connection >= 0) {
+        close(connection);
+    }
+}
+
+bool SocketSink::Connect(std::string const& host, std::string const& port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+
+    for (addrinfo* address = addresses; address; address = address->ai_next) {
+        int candidate = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+        if (candidate < 0) {
+            continue;
+        }
+
+        if (connect(candidate, address->ai_addr, address->ai_addrlen) == 0) {
+            connection = candidate;
+            break;
+        }
+
+        close(candidate);
+    }
+
+    freeaddrinfo(addresses);
+
+    return connection >= 0;
+}
+
+bool SocketSink::Write(uint8_t const* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+    // A viewer hanging up should fail the write, not kill the emulator with SIGPIPE
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+
+    while (size) {
+        ssize_t sent = send(connection, data, size, flags);
+
+        if (sent <= 0) {
+            return false;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+#endif
+
+std::unique_ptr<FrameSink> OpenFrameSink(std::string const& target) {
+    std::string const scheme = "tcp://";
+
+    if (target.compare(0, scheme.size(), scheme) == 0) {
+        std::string address = target.substr(scheme.size());
+        size_t colon = address.rfind(':');
+
+        if (colon == std::string::npos) {
+            return nullptr;
+        }
+
+        std::unique_ptr<SocketSink> sink(new SocketSink);
+
+        if (!sink->Connect(address.substr(0, colon), address.substr(colon + 1))) {
+            return nullptr;
+        }
+
+        return sink;
+    }
+
+    std::unique_ptr<FileSink> sink(new FileSink);
+
+    if (!sink->Open(target.c_str())) {
+        return nullptr;
+    }
+
+    return sink;
+}
+
+// FRAME ENCODER
+
+static void PackFrame(uint64_t const* video, uint8_t* bytes) {
+    for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row) {
+        for (unsigned int byte = 0; byte < 8; ++byte) {
+            *bytes++ = (video[row] >> (56u - 8u * byte)) & 0xFFu;
+        }
+    }
+}
+
+FrameEncoder::FrameEncoder(unsigned int keyframeInterval)
+    : keyframeInterval(keyframeInterval) {
+}
+
+void FrameEncoder::Header(std::vector<uint8_t>& out) const {
+    out.insert(out.end(), {'C', '8', 'F', 'S', VERSION});
+
+    PutVarint(out, VIDEO_WIDTH);
+    PutVarint(out, VIDEO_HEIGHT);
+}
+
+void FrameEncoder::Encode(uint64_t frame, uint64_t const* video, std::vector<uint8_t>& out) {
+    PackFrame(video, current);
+
+    if (started && memcmp(current, previous, FRAME_BYTES) == 0) {
+        return;
+    }
+
+    bool keyframe = !started || sinceKeyframe + 1 >= keyframeInterval;
+
+    payload.clear();
+
+    if (keyframe) {
+        payload.assign(current, current + FRAME_BYTES);
+        sinceKeyframe = 0;
+    } else {
+        EncodeDelta(previous, current, FRAME_BYTES, payload);
+        ++sinceKeyframe;
+    }
+
+    PutVarint(out, started ? frame - lastFrame : frame);
+    out.push_back(keyframe ? KEYFRAME : DELTA);
+    PutVarint(out, payload.size());
+    out.insert(out.end(), payload.begin(), payload.end());
+
+    memcpy(previous, current, FRAME_BYTES);
+    lastFrame = frame;
+    started = true;
+}
+
+// FRAME DECODER
+
+// Like GetVarint(), but refuses to read past end
+static bool ReadVarint(uint8_t const*& data, uint8_t const* end, size_t& value) {
+    value = 0;
+
+    for (unsigned int shift = 0; data < end && shift < 64; shift += 7u) {
+        uint8_t byte = *data++;
+        value |= static_cast<size_t>(byte & 0x7Fu) << shift;
+
+        if (!(byte & 0x80u)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t FrameDecoder::ReadHeader(uint8_t const* data, size_t size) {
+    uint8_t const* position = data;
+    uint8_t const* end = data + size;
+
+    if (size < 5 || memcmp(data, "C8FS", 4) != 0 || data[4] != FrameEncoder::VERSION) {
+        return 0;
+    }
+
+    position += 5;
+
+    size_t width, height;
+
+    if (!ReadVarint(position, end, width) || !ReadVarint(position, end, height)
+        || width != VIDEO_WIDTH || height != VIDEO_HEIGHT) {
+        return 0;
+    }
+
+    return position - data;
+}
+
+size_t FrameDecoder::ReadRecord(uint8_t const* data, size_t size) {
+    uint8_t const* position = data;
+    uint8_t const* end = data + size;
+
+    size_t frames, payloadSize;
+
+    if (!ReadVarint(position, end, frames) || position == end) {
+        return 0;
+    }
+
+    uint8_t kind = *position++;
+
+    if (!ReadVarint(position, end, payloadSize) || payloadSize > static_cast<size_t>(end - position)) {
+        return 0;
+    }
+
+    if (kind == FrameEncoder::KEYFRAME) {
+        if (payloadSize != FrameEncoder::FRAME_BYTES) {
+            return 0;
+        }
+
+        memcpy(bytes, position, payloadSize);
+    } else if (kind == FrameEncoder::DELTA && started) {
+        // Check the runs stay inside the frame before applying any of them. The counts
+        // come off the stream and can be anything, so they're checked one at a time
+        // rather than added up, which could wrap round.
+        uint8_t const* run = position;
+        uint8_t const* runEnd = position + payloadSize;
+        size_t covered = 0;
+
+        while (run < runEnd) {
+            size_t unchanged, literals;
+
+            if (!ReadVarint(run, runEnd, unchanged) || !ReadVarint(run, runEnd, literals)
+                || literals > static_cast<size_t>(runEnd - run)
+                || unchanged > FrameEncoder::FRAME_BYTES - covered
+                || literals > FrameEncoder::FRAME_BYTES - covered - unchanged) {
+                return 0;
+            }
+
+            covered += unchanged + literals;
+            run += literals;
+        }
+
+        DecodeDelta(position, payloadSize, bytes);
+    } else {
+        return 0;
+    }
+
+    frame = started ? frame + frames : frames;
+    started = true;
+
+    uint8_t const* row = bytes;
+
+    for (uint64_t& screenRow : video) {
+        screenRow = 0;
+
+        for (unsigned int byte = 0; byte < 8; ++byte) {
+            screenRow = (screenRow << 8u) | *row++;
+        }
+    }
+
+    return position + payloadSize - data;
+}
+
+// FRAME STREAMER
+
+FrameStreamer::FrameStreamer(std::unique_ptr<FrameSink> sink, unsigned int keyframeInterval)
+    : sink(std::move(sink)), encoder(keyframeInterval) {
+    writer = std::thread(&FrameStreamer::Write, this);
+}
+
+FrameStreamer::~FrameStreamer() {
+    stopping.store(true, std::memory_order_release);
+    ready.notify_one();
+
+    writer.join();
+}
+
+bool FrameStreamer::Push(uint64_t frame, uint64_t const* video) {
+    Message message;
+    message.frame = frame;
+    memcpy(message.video, video, sizeof(message.video));
+
+    if (!queue.Push(message)) {
+        droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    ready.notify_one();
+
+    return true;
+}
+
+void FrameStreamer::Write() {
+    std::vector<uint8_t> out;
+    encoder.Header(out);
+
+    Message message;
+
+    for (;;) {
+        // Stopping is looked at before the queue, so frames pushed before the destructor
+        // ran still get written
+        bool last = stopping.load(std::memory_order_acquire);
+
+        while (queue.Pop(message)) {
+            encoder.Encode(message.frame, message.video, out);
+        }
+
+        if (!out.empty() && !failed.load(std::memory_order_relaxed)) {
+            if (!sink->Write(out.data(), out.size())) {
+                failed.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        out.clear();
+
+        if (last) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait_for(lock, WRITER_WAIT, [this] {
+            return queue.Size() || stopping.load(std::memory_order_acquire);
+        });
+    }
+}
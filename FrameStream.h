@@ -0,0 +1,165 @@
+//
+// Streams the display out as compact encoded frames, to a file or a socket, from a thread
+// of its own.
+//
+
+#include "Chip8.h"
+#include "SpscQueue.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_FRAMESTREAM_H
+#define EMULATOR_CHIP_8_FRAMESTREAM_H
+
+
+// FRAME SINKS
+/* Where an encoded stream ends up. Write() is only ever called from the streamer's own
+ * thread, so it's free to block; returning false means the sink is gone for good (the
+ * disk filled up, the viewer hung up) and nothing more is written to it.
+ */
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    virtual bool Write(uint8_t const* data, size_t size) = 0;
+};
+
+class FileSink : public FrameSink {
+public:
+    ~FileSink() override;
+
+    bool Open(char const* filename);
+    bool Write(uint8_t const* data, size_t size) override;
+
+private:
+    std::FILE* file{};
+};
+
+// A TCP connection to a viewer that is already listening
+class SocketSink : public FrameSink {
+public:
+    ~SocketSink() override;
+
+    bool Connect(std::string const& host, std::string const& port);
+    bool Write(uint8_t const* data, size_t size) override;
+
+private:
+#ifdef _WIN32
+    uintptr_t connection = ~uintptr_t(0);
+#else
+    int connection = -1;
+#endif
+};
+
+// tcp://host:port connects to a viewer, anything else is a file name. Null if neither works.
+std::unique_ptr<FrameSink> OpenFrameSink(std::string const& target);
+
+// FRAME STREAM FORMAT
+/* A stream starts with a header: the bytes "C8FS", a version byte, then the width and
+ * height in pixels as varints. After that come records, one per frame that changed:
+ *
+ *     <frames since the last record> <kind> <payload size> <payload>
+ *
+ * with the counts as varints (see DeltaCoding.h) and the frame number of the first record
+ * counted from 0. The payload is the frame one row after the other, eight pixels to a byte
+ * with the leftmost in the top bit, 256 bytes in all. A keyframe (kind 0) carries that as
+ * it is; a delta (kind 1) carries it as a delta against the frame of the record before.
+ * A sprite moving is a few bytes of delta, and a frame that doesn't change isn't sent.
+ */
+class FrameEncoder {
+public:
+    explicit FrameEncoder(unsigned int keyframeInterval = 60);
+
+    void Header(std::vector<uint8_t>& out) const;
+
+    // Appends the record for the given frame, or nothing if it's the same as the last one
+    void Encode(uint64_t frame, uint64_t const* video, std::vector<uint8_t>& out);
+
+    static constexpr uint8_t VERSION = 1;
+    static constexpr uint8_t KEYFRAME = 0;
+    static constexpr uint8_t DELTA = 1;
+    static constexpr size_t FRAME_BYTES = VIDEO_HEIGHT * VIDEO_WIDTH / 8;
+
+private:
+    unsigned int keyframeInterval;
+    unsigned int sinceKeyframe{};
+    bool started{};
+    uint64_t lastFrame{};
+    uint8_t previous[FRAME_BYTES]{};
+    uint8_t current[FRAME_BYTES]{};
+    std::vector<uint8_t> payload;
+};
+
+// Reads a stream back, a record at a time, for players and archive tools
+class FrameDecoder {
+public:
+    // Both return how many bytes they used up, or 0 if the data is malformed or doesn't
+    // hold a whole header or record yet
+    size_t ReadHeader(uint8_t const* data, size_t size);
+    size_t ReadRecord(uint8_t const* data, size_t size);
+
+    uint64_t frame{};
+    uint64_t video[VIDEO_HEIGHT]{};
+
+private:
+    bool started{};
+    uint8_t bytes[FrameEncoder::FRAME_BYTES]{};
+};
+
+// FRAME STREAMER
+/* Push() is for the emulation thread: it copies the display into a lock-free queue and
+ * returns, and never waits on anything. A writer thread of the streamer's own takes
+ * frames off the queue, encodes them and writes them to the sink at whatever pace the
+ * sink manages. If the sink falls so far behind that the queue fills up, frames are
+ * dropped rather than held up, and the next one that gets through is encoded against
+ * the last one that did, so the stream stays correct - it just skips ahead.
+ *
+ * Destroying the streamer writes out whatever is still queued.
+ */
+class FrameStreamer {
+public:
+    explicit FrameStreamer(std::unique_ptr<FrameSink> sink, unsigned int keyframeInterval = 60);
+
+    ~FrameStreamer();
+
+    FrameStreamer(FrameStreamer const&) = delete;
+    FrameStreamer& operator=(FrameStreamer const&) = delete;
+
+    // False if the frame had to be dropped
+    bool Push(uint64_t frame, uint64_t const* video);
+
+    uint64_t DroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+    bool Failed() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+    struct Message {
+        uint64_t frame;
+        uint64_t video[VIDEO_HEIGHT];
+    };
+
+    void Write();
+
+    std::unique_ptr<FrameSink> sink;
+    FrameEncoder encoder;
+    SpscQueue<Message, 64> queue;
+
+    // Only for the writer to sleep on; Push() never takes it
+    std::mutex mutex;
+    std::condition_variable ready;
+
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> droppedFrames{0};
+
+    std::thread writer;
+};
+
+
+#endif //EMULATOR_CHIP_8_FRAMESTREAM_H
@@ -0,0 +1,129 @@
+//
+// Scripted keypad input for running ROMs without a window.
+//
+
+#include "InputScript.h"
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+bool InputScript::Load(char const* filename) {
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    *this = InputScript();
+
+    std::string line;
+
+    while (std::getline(file, line)) {
+        // Drop comments
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        std::string first;
+
+        if (!(fields >> first)) {
+            // Nothing but whitespace on this line
+            continue;
+        }
+
+        if (first == "seed" || first == "ips" || first == "end") {
+            uint64_t value;
+
+            if (!(fields >> value)) {
+                return false;
+            }
+
+            if (first == "seed") {
+                seeded = true;
+                seed = value;
+            } else if (first == "ips") {
+                instructionsPerSecond = value;
+            } else {
+                end = value;
+            }
+
+            continue;
+        }
+
+        std::string key;
+        std::string state;
+
+        if (!std::isdigit(static_cast<unsigned char>(first[0])) || !(fields >> key >> state) || key.size() != 1
+            || !std::isxdigit(static_cast<unsigned char>(key[0])) || (state != "down" && state != "up")) {
+            return false;
+        }
+
+        uint64_t cycle = std::stoull(first);
+
+        events.push_back({cycle, static_cast<uint8_t>(std::stoi(key, nullptr, 16)), state == "down"});
+    }
+
+    // Events apply in order of time, whatever order they were written in
+    std::stable_sort(events.begin(), events.end(), [](InputEvent const& a, InputEvent const& b) {
+        return a.cycle < b.cycle;
+    });
+
+    return true;
+}
+
+bool InputScript::Save(char const* filename) const {
+    std::ofstream file(filename);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    if (seeded) {
+        file << "seed " << seed << "\n";
+    }
+
+    if (instructionsPerSecond) {
+        file << "ips " << instructionsPerSecond << "\n";
+    }
+
+    for (InputEvent const& event : events) {
+        file << event.cycle << " " << std::hex << std::uppercase << static_cast<int>(event.key) << std::dec
+             << (event.pressed ? " down" : " up") << "\n";
+    }
+
+    if (end) {
+        file << "end " << end << "\n";
+    }
+
+    return static_cast<bool>(file);
+}
+
+InputRecorder::InputRecorder(uint64_t seed, uint64_t instructionsPerSecond) {
+    script.seeded = true;
+    script.seed = seed;
+    script.instructionsPerSecond = instructionsPerSecond;
+}
+
+void InputRecorder::Record(uint64_t cycle, uint16_t keys) {
+    uint16_t changed = keys ^ lastKeys;
+
+    for (uint8_t key = 0; changed; ++key, changed >>= 1u) {
+        if (changed & 0x1u) {
+            script.events.push_back({cycle, key, ((keys >> key) & 0x1u) != 0});
+        }
+    }
+
+    lastKeys = keys;
+}
+
+bool InputRecorder::Save(char const* filename, uint64_t endCycle) {
+    script.end = endCycle;
+
+    return script.Save(filename);
+}
+
+uint64_t RunScripted(Chip8& chip8, InputScript const& script, uint64_t cycles, uint64_t instructionsPerSecond) {
+    NullProfiler profiler;
+
+    return RunScripted(chip8, script, cycles, instructionsPerSecond, profiler);
+}
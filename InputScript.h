@@ -0,0 +1,119 @@
+//
+// Scripted keypad input for running ROMs without a window.
+//
+
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_INPUTSCRIPT_H
+#define EMULATOR_CHIP_8_INPUTSCRIPT_H
+
+// INPUT EVENT
+/* A single key going down or up, timed by the number of instructions that have run
+ * before it happens. Timing by instruction count rather than wall clock time makes a
+ * script play out exactly the same way on any machine, at any speed.
+ */
+struct InputEvent {
+    uint64_t cycle;
+    uint8_t key;
+    bool pressed;
+};
+
+// INPUT SCRIPT
+/* A list of input events in the order they happen, read from a text file with one event
+ * per line:
+ *
+ *     <cycle> <key> <down|up>
+ *
+ * where the key is a hex digit 0-F. Blank lines and anything after a # are ignored.
+ *
+ * A script can also pin down everything else a run depends on, so that playing it back
+ * reproduces a session exactly:
+ *
+ *     seed <n>    seed for the random number generator
+ *     ips <n>     instructions per second, which decides where the timers tick
+ *     end <n>     how many instructions the session ran for
+ */
+class InputScript {
+public:
+    bool Load(char const* filename);
+    bool Save(char const* filename) const;
+
+    std::vector<InputEvent> events;
+
+    bool seeded{};
+    uint64_t seed{};
+    uint64_t instructionsPerSecond{};
+    uint64_t end{};
+};
+
+// INPUT RECORDER
+/* Builds an input script from a live session. Record() is handed the keypad once per
+ * frame, before the frame runs, together with the instruction count at that point, and
+ * turns every key that changed since the last call into an event.
+ */
+class InputRecorder {
+public:
+    InputRecorder(uint64_t seed, uint64_t instructionsPerSecond);
+
+    void Record(uint64_t cycle, uint16_t keys);
+    bool Save(char const* filename, uint64_t endCycle);
+
+    InputScript script;
+
+private:
+    uint16_t lastKeys{};
+};
+
+// Where a frame ends when instructionsPerSecond are split over 60 frames a second, the
+// same way FrameScheduler splits them
+inline uint64_t FrameEnd(uint64_t frame, uint64_t instructionsPerSecond) {
+    return (frame + 1) * instructionsPerSecond / 60;
+}
+
+// Run the Chip8 for the given number of instructions, pressing and releasing keys as the
+// script says and ticking the timers at the end of every 60Hz frame's worth of
+// instructionsPerSecond.
+uint64_t RunScripted(Chip8& chip8, InputScript const& script, uint64_t cycles, uint64_t instructionsPerSecond);
+
+template <typename Profiler>
+uint64_t RunScripted(Chip8& chip8, InputScript const& script, uint64_t cycles, uint64_t instructionsPerSecond,
+                     Profiler& profiler) {
+    /* Instructions run in batches that stop at whichever comes first: the end of the
+     * current frame (when the timers tick), the next scripted event, or the end of the run.
+     * This matches what the main loop does, frame for frame, so a recorded session plays
+     * back the same way, only without waiting for the clock.
+     */
+    uint64_t executed = 0;
+    uint64_t frame = 0;
+    uint64_t frameEnd = FrameEnd(frame, instructionsPerSecond);
+    size_t next = 0;
+
+    while (executed < cycles) {
+        while (next < script.events.size() && script.events[next].cycle <= executed) {
+            chip8.SetKey(script.events[next].key, script.events[next].pressed);
+            ++next;
+        }
+
+        uint64_t stop = std::min(cycles, frameEnd);
+
+        if (next < script.events.size()) {
+            stop = std::min(stop, script.events[next].cycle);
+        }
+
+        executed += chip8.RunProfiled(static_cast<unsigned int>(stop - executed), profiler);
+
+        // Frames too short to hold an instruction of their own still tick the timers
+        while (executed == frameEnd) {
+            chip8.TickTimers();
+            frameEnd = FrameEnd(++frame, instructionsPerSecond);
+        }
+    }
+
+    return executed;
+}
+
+
+#endif //EMULATOR_CHIP_8_INPUTSCRIPT_H
@@ -0,0 +1,205 @@
+//
+// Live counters for a running machine, read and exported from a thread of their own.
+//
+
+#include "Metrics.h"
+#include <cstdio>
+
+// METRICS
+
+void Metrics::RecordFrame(uint64_t instructions, uint64_t idleInstructions, uint64_t sprites,
+                          uint64_t const* families, uint64_t droppedFrames, bool drawn,
+                          std::chrono::nanoseconds frameTime) {
+    Store(this->instructions, instructions);
+    Store(this->idleInstructions, idleInstructions);
+    Store(this->sprites, sprites);
+    Store(this->droppedFrames, droppedFrames);
+
+    for (unsigned int i = 0; i < OPCODE_FAMILIES; ++i) {
+        Store(this->families[i], families[i]);
+    }
+
+    Store(frames, frames.load(std::memory_order_relaxed) + 1);
+
+    if (drawn) {
+        Store(drawnFrames, drawnFrames.load(std::memory_order_relaxed) + 1);
+    }
+
+    uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(frameTime).count();
+    std::atomic<uint64_t>& bucket = frameTimes[FrameTimeBucket(microseconds)];
+
+    Store(bucket, bucket.load(std::memory_order_relaxed) + 1);
+}
+
+Metrics::Snapshot Metrics::Read() const {
+    Snapshot snapshot{};
+
+    snapshot.instructions = instructions.load(std::memory_order_relaxed);
+    snapshot.idleInstructions = idleInstructions.load(std::memory_order_relaxed);
+    snapshot.sprites = sprites.load(std::memory_order_relaxed);
+    snapshot.frames = frames.load(std::memory_order_relaxed);
+    snapshot.drawnFrames = drawnFrames.load(std::memory_order_relaxed);
+    snapshot.droppedFrames = droppedFrames.load(std::memory_order_relaxed);
+
+    for (unsigned int i = 0; i < OPCODE_FAMILIES; ++i) {
+        snapshot.families[i] = families[i].load(std::memory_order_relaxed);
+    }
+
+    for (unsigned int i = 0; i < FRAME_TIME_BUCKETS; ++i) {
+        snapshot.frameTimes[i] = frameTimes[i].load(std::memory_order_relaxed);
+    }
+
+    return snapshot;
+}
+
+unsigned int Metrics::FrameTimeBucket(uint64_t microseconds) {
+    // Under 4us a bucket each, then four to every power of two from its top two bits
+    if (microseconds < 4) {
+        return static_cast<unsigned int>(microseconds);
+    }
+
+    unsigned int power = 2;
+
+    while (microseconds >> (power + 1)) {
+        ++power;
+    }
+    unsigned int bucket = 4 * (power - 1) + ((microseconds >> (power - 2)) & 0x3u);
+
+    return bucket < FRAME_TIME_BUCKETS ? bucket : FRAME_TIME_BUCKETS - 1;
+}
+
+uint64_t Metrics::BucketLimit(unsigned int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    unsigned int power = bucket / 4 + 1;
+
+    return ((5u + bucket % 4) << (power - 2)) - 1;
+}
+
+// METRICS EXPORTER
+
+MetricsExporter::MetricsExporter(std::unique_ptr<FrameSink> sink, std::vector<Metrics const*> metrics,
+                                 std::chrono::milliseconds interval)
+    : sink(std::move(sink)), metrics(std::move(metrics)), interval(interval) {
+    exporter = std::thread(&MetricsExporter::Export, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_one();
+
+    exporter.join();
+}
+
+// The bucket limit at or under which the given fraction of the frames fell
+static uint64_t Percentile(uint64_t const* counts, uint64_t total, double fraction) {
+    uint64_t wanted = static_cast<uint64_t>(fraction * total + 0.5);
+    uint64_t seen = 0;
+
+    for (unsigned int bucket = 0; bucket < Metrics::FRAME_TIME_BUCKETS; ++bucket) {
+        seen += counts[bucket];
+
+        if (seen && seen >= wanted) {
+            return Metrics::BucketLimit(bucket);
+        }
+    }
+
+    return 0;
+}
+
+std::string MetricsExporter::Format(std::string const& name, Metrics::Snapshot const& before,
+                                    Metrics::Snapshot const& after, double seconds, double time) {
+    uint64_t counts[Metrics::FRAME_TIME_BUCKETS];
+    uint64_t frames = 0;
+    unsigned int longest = 0;
+
+    for (unsigned int i = 0; i < Metrics::FRAME_TIME_BUCKETS; ++i) {
+        counts[i] = after.frameTimes[i] - before.frameTimes[i];
+        frames += counts[i];
+
+        if (counts[i]) {
+            longest = i;
+        }
+    }
+
+    double perSecond = seconds > 0 ? 1.0 / seconds : 0.0;
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "time=%.3f instance=%s ips=%.0f idle_ips=%.0f sprites=%llu frames=%llu drawn=%llu dropped=%llu"
+                  " frame_us_p50=%llu frame_us_p90=%llu frame_us_p99=%llu frame_us_max=%llu",
+                  time, name.c_str(),
+                  (after.instructions - before.instructions) * perSecond,
+                  (after.idleInstructions - before.idleInstructions) * perSecond,
+                  static_cast<unsigned long long>(after.sprites - before.sprites),
+                  static_cast<unsigned long long>(after.frames - before.frames),
+                  static_cast<unsigned long long>(after.drawnFrames - before.drawnFrames),
+                  static_cast<unsigned long long>(after.droppedFrames - before.droppedFrames),
+                  static_cast<unsigned long long>(Percentile(counts, frames, 0.50)),
+                  static_cast<unsigned long long>(Percentile(counts, frames, 0.90)),
+                  static_cast<unsigned long long>(Percentile(counts, frames, 0.99)),
+                  static_cast<unsigned long long>(frames ? Metrics::BucketLimit(longest) : 0));
+
+    std::string out = line;
+
+    for (unsigned int i = 0; i < Metrics::OPCODE_FAMILIES; ++i) {
+        std::snprintf(line, sizeof(line), " op_%x=%llu", i,
+                      static_cast<unsigned long long>(after.families[i] - before.families[i]));
+        out += line;
+    }
+
+    out += "\n";
+
+    return out;
+}
+
+void MetricsExporter::Export() {
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+
+    std::vector<Metrics::Snapshot> previous;
+
+    for (Metrics const* instance : metrics) {
+        previous.push_back(instance->Read());
+    }
+
+    std::string out;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if (wake.wait_for(lock, interval, [this] { return stopping; })) {
+                return;
+            }
+        }
+
+        Clock::time_point now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        double time = std::chrono::duration<double>(now - start).count();
+
+        out.clear();
+
+        for (size_t i = 0; i < metrics.size(); ++i) {
+            Metrics::Snapshot current = metrics[i]->Read();
+
+            out += Format(metrics[i]->Name(), previous[i], current, seconds, time);
+            previous[i] = current;
+        }
+
+        last = now;
+
+        if (!sink->Write(reinterpret_cast<uint8_t const*>(out.data()), out.size())) {
+            failed.store(true, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
@@ -0,0 +1,132 @@
+//
+// Live counters for a running machine, read and exported from a thread of their own.
+//
+
+#include "FrameStream.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_METRICS_H
+#define EMULATOR_CHIP_8_METRICS_H
+
+
+// METRICS
+/* One per running instance. The emulation thread records into it once a frame, after the
+ * frame ran, never per instruction: the counts it records (instructions, sprites, and
+ * instructions dispatched per opcode family) already sit in Chip8 as plain integers, so
+ * all the hot path does is bump those.
+ *
+ * Every field has a single writer, so recording is a relaxed load and store of each atomic
+ * rather than a locked add, which on x86 is an ordinary move. Any other thread can Read()
+ * at any time. A snapshot isn't taken all at once, so two fields can be a frame apart, but
+ * each one on its own is always a value it really had.
+ *
+ * Frame times (how long the emulation worked on a frame, not counting the wait for its
+ * deadline) go into a histogram in microseconds with four buckets per power of two, which
+ * keeps the percentiles worked out from it within 25%.
+ */
+class Metrics {
+public:
+    static const unsigned int FRAME_TIME_BUCKETS = 64;
+    static const unsigned int OPCODE_FAMILIES = 16;
+
+    struct Snapshot {
+        uint64_t instructions;
+        uint64_t idleInstructions;
+        uint64_t sprites;
+        uint64_t families[OPCODE_FAMILIES];
+        uint64_t frames;
+        uint64_t drawnFrames;
+        uint64_t droppedFrames;
+        uint64_t frameTimes[FRAME_TIME_BUCKETS];
+    };
+
+    explicit Metrics(std::string name) : name(std::move(name)) {}
+
+    // Emulation thread only. The totals are the machine's and scheduler's own running
+    // counts, families one per opcode family; drawn says whether the frame changed the
+    // display.
+    void RecordFrame(uint64_t instructions, uint64_t idleInstructions, uint64_t sprites,
+                     uint64_t const* families, uint64_t droppedFrames, bool drawn,
+                     std::chrono::nanoseconds frameTime);
+
+    Snapshot Read() const;
+
+    std::string const& Name() const { return name; }
+
+    // The bucket a frame time goes in, and the longest time that bucket holds
+    static unsigned int FrameTimeBucket(uint64_t microseconds);
+    static uint64_t BucketLimit(unsigned int bucket);
+
+private:
+    static void Store(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(value, std::memory_order_relaxed);
+    }
+
+    std::string name;
+
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<uint64_t> idleInstructions{0};
+    std::atomic<uint64_t> sprites{0};
+    std::atomic<uint64_t> families[OPCODE_FAMILIES]{};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> drawnFrames{0};
+    std::atomic<uint64_t> droppedFrames{0};
+    std::atomic<uint64_t> frameTimes[FRAME_TIME_BUCKETS]{};
+};
+
+// METRICS EXPORTER
+/* Every interval, reads each Metrics it was given and writes one line per instance to a
+ * sink (see FrameStream.h: a file, or a local listener at tcp://host:port), in logfmt:
+ *
+ *     time=12.000 instance=main ips=600000 idle_ips=0 sprites=1740 frames=60 drawn=58
+ *         dropped=0 frame_us_p50=112 frame_us_p90=128 frame_us_p99=224 frame_us_max=256
+ *         op_0=1200 op_1=9000 ... op_f=4100
+ *
+ * (all on one line), op_0 to op_f being the instructions dispatched per opcode family,
+ * which shows what the program is busy with and, next to ips, what it costs. Everything
+ * but time is over the interval just gone, worked out from the difference between two
+ * snapshots, so the emulation side never has to reset anything. The exporter sleeps
+ * between intervals and costs the emulation nothing but the reads.
+ */
+class MetricsExporter {
+public:
+    MetricsExporter(std::unique_ptr<FrameSink> sink, std::vector<Metrics const*> metrics,
+                    std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+    ~MetricsExporter();
+
+    MetricsExporter(MetricsExporter const&) = delete;
+    MetricsExporter& operator=(MetricsExporter const&) = delete;
+
+    bool Failed() const { return failed.load(std::memory_order_relaxed); }
+
+    // One instance's line for the change from before to after, over the given seconds
+    static std::string Format(std::string const& name, Metrics::Snapshot const& before,
+                              Metrics::Snapshot const& after, double seconds, double time);
+
+private:
+    void Export();
+
+    std::unique_ptr<FrameSink> sink;
+    std::vector<Metrics const*> metrics;
+    std::chrono::milliseconds interval;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::atomic<bool> failed{false};
+
+    std::thread exporter;
+};
+
+
+#endif //EMULATOR_CHIP_8_METRICS_H
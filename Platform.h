@@ -5,35 +5,135 @@
 #ifndef EMULATOR_CHIP_8_PLATFORM_H
 #define EMULATOR_CHIP_8_PLATFORM_H
 
+#include "Beeper.h"
+#include "Chip8.h"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 class Platform {
     public:
-    Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight) {
-        SDL_Init(SDL_INIT_VIDEO);
+    Platform(char const* title, int windowWidth, int windowHeight, int videoWidth, int videoHeight)
+        : width(videoWidth), height(videoHeight) {
+        SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
 
         window = SDL_CreateWindow(title, 0,0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
 
         renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 
-        texture = SDL_CreateTexture(
-                renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, texureWidth, textureHeight);
+        // Draw in display pixels and let the renderer scale them up to the window
+        SDL_RenderSetLogicalSize(renderer, videoWidth, videoHeight);
+
+        // Enough for the worst case, every other pixel lit, on the biggest display
+        for (std::vector<SDL_Rect>& colorRects : rects) {
+            colorRects.reserve(HIRES_WIDTH / 2 * HIRES_HEIGHT);
+        }
+
+        // The keyboard keys for CHIP-8 keys 0 through F, in that order
+        const char layout[] = "x123qweasdzc4rfv";
+
+        std::fill(std::begin(keymap), std::end(keymap), -1);
+
+        for (int key = 0; key < 16; ++key)
+        {
+            keymap[static_cast<unsigned char>(layout[key])] = key;
+        }
     }
 
     ~Platform() {
-        SDL_DestroyTexture(texture);
+        if (audioDevice) {
+            SDL_CloseAudioDevice(audioDevice);
+        }
+
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
     }
 
-    void Update(void const* buffer, int pitch) {
-        SDL_UpdateTexture(texture, nullptr, buffer, pitch);
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-        SDL_RenderPresent(renderer);
+    /* Takes the display as Chip8 keeps it, width / 64 words per row with the leftmost
+     * pixel in the top bit, and turns every run of lit pixels in a word into one filled
+     * rect. The GPU does the scaling and the coloring, so all that's done here per frame is
+     * a few bit scans per row, and a mostly empty display costs next to nothing.
+     *
+     * With two planes each pixel is one of four colors, so the rects are kept apart by
+     * which planes are lit and the runs are found in a mask per color.
+     *
+     * The display is only read during the call, nothing of it is kept. Only needs calling
+     * when the frame changed; redrawing uses the rects from the last one.
+     */
+    void Update(Chip8::Display const& display) {
+        if (static_cast<int>(display.width) != width || static_cast<int>(display.height) != height) {
+            width = static_cast<int>(display.width);
+            height = static_cast<int>(display.height);
+            SDL_RenderSetLogicalSize(renderer, width, height);
+        }
+
+        for (std::vector<SDL_Rect>& colorRects : rects) {
+            colorRects.clear();
+        }
+
+        int wordsPerRow = width / 64;
+        size_t planeWords = static_cast<size_t>(wordsPerRow) * height;
+
+        for (int y = 0; y < height; ++y) {
+            for (int word = 0; word < wordsPerRow; ++word) {
+                size_t at = static_cast<size_t>(y) * wordsPerRow + word;
+
+                uint64_t first = display.rows[at];
+                uint64_t second = display.planes > 1 ? display.rows[planeWords + at] : 0;
+
+                AddRuns(first & ~second, word * 64, y, rects[0]);
+                AddRuns(second & ~first, word * 64, y, rects[1]);
+                AddRuns(first & second, word * 64, y, rects[2]);
+            }
+        }
+
+        Present();
+    }
+
+    // Colors as 0xRRGGBB for lit and unlit pixels
+    void SetPalette(uint32_t foreground, uint32_t background) {
+        palette[1] = foreground;
+        palette[0] = background;
+        Present();
     }
 
-    bool ProcessInput(uint8_t* keys)
+    /* Starts the default audio device playing from the ring, which the emulation side
+     * fills with a Beeper. The device asks for small blocks (AUDIO_DEVICE_SAMPLES, about
+     * 5ms) so that a sample doesn't sit in its buffer much longer than in the ring.
+     *
+     * The ring has to outlive the Platform. Returns false if there's no audio to be had,
+     * and everything else carries on without it.
+     */
+    bool OpenAudio(AudioRing& ring) {
+        SDL_AudioSpec wanted{};
+        wanted.freq = AUDIO_SAMPLE_RATE;
+        wanted.format = AUDIO_S16SYS;
+        wanted.channels = 1;
+        wanted.samples = static_cast<Uint16>(AUDIO_DEVICE_SAMPLES);
+        wanted.callback = AudioCallback;
+        wanted.userdata = &ring;
+
+        // No changes allowed, so SDL converts to whatever the device really wants
+        audioDevice = SDL_OpenAudioDevice(nullptr, 0, &wanted, nullptr, 0);
+
+        if (!audioDevice) {
+            return false;
+        }
+
+        SDL_PauseAudioDevice(audioDevice, 0);
+
+        return true;
+    }
+
+    // Keys are updated in place, one bit per CHIP-8 key like Chip8::keys
+    bool ProcessInput(uint16_t& keys)
     {
         bool quit = false;
 
@@ -41,200 +141,163 @@ class Platform {
 
         while (SDL_PollEvent(&event))
         {
-            switch (event.type)
+            quit = HandleEvent(event, keys) || quit;
+        }
+
+        return quit;
+    }
+
+    // Sleep until an event arrives or the timeout runs out, then handle everything pending
+    bool WaitInput(uint16_t& keys, int timeoutMs)
+    {
+        SDL_Event event;
+
+        if (!SDL_WaitEventTimeout(&event, timeoutMs))
+        {
+            return false;
+        }
+
+        bool quit = HandleEvent(event, keys);
+
+        return ProcessInput(keys) || quit;
+    }
+
+    // Wake up a WaitInput() on the window's thread. Safe to call from any thread.
+    static void Wake()
+    {
+        SDL_Event event{};
+        event.type = SDL_USEREVENT;
+        SDL_PushEvent(&event);
+    }
+
+    // Whether the rewind key (Backspace) is down right now, as of the last event handled
+    bool RewindHeld() const
+    {
+        return SDL_GetKeyboardState(nullptr)[SDL_SCANCODE_BACKSPACE] != 0;
+    }
+
+
+private:
+    bool HandleEvent(SDL_Event const& event, uint16_t& keys)
+    {
+        bool quit = false;
+
+        switch (event.type)
+        {
+            case SDL_QUIT:
+            {
+                quit = true;
+            } break;
+
+            case SDL_WINDOWEVENT:
             {
-                case SDL_QUIT:
+                // The window lost its contents, show the last frame again
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
                 {
-                    quit = true;
-                } break;
+                    Present();
+                }
+            } break;
 
-                case SDL_KEYDOWN:
+            case SDL_KEYDOWN:
+            {
+                if (event.key.keysym.sym == SDLK_ESCAPE)
                 {
-                    switch (event.key.keysym.sym)
-                    {
-                        case SDLK_ESCAPE:
-                        {
-                            quit = true;
-                        } break;
-
-                        case SDLK_x:
-                        {
-                            keys[0] = 1;
-                        } break;
-
-                        case SDLK_1:
-                        {
-                            keys[1] = 1;
-                        } break;
-
-                        case SDLK_2:
-                        {
-                            keys[2] = 1;
-                        } break;
-
-                        case SDLK_3:
-                        {
-                            keys[3] = 1;
-                        } break;
-
-                        case SDLK_q:
-                        {
-                            keys[4] = 1;
-                        } break;
-
-                        case SDLK_w:
-                        {
-                            keys[5] = 1;
-                        } break;
-
-                        case SDLK_e:
-                        {
-                            keys[6] = 1;
-                        } break;
-
-                        case SDLK_a:
-                        {
-                            keys[7] = 1;
-                        } break;
-
-                        case SDLK_s:
-                        {
-                            keys[8] = 1;
-                        } break;
-
-                        case SDLK_d:
-                        {
-                            keys[9] = 1;
-                        } break;
-
-                        case SDLK_z:
-                        {
-                            keys[0xA] = 1;
-                        } break;
-
-                        case SDLK_c:
-                        {
-                            keys[0xB] = 1;
-                        } break;
-
-                        case SDLK_4:
-                        {
-                            keys[0xC] = 1;
-                        } break;
-
-                        case SDLK_r:
-                        {
-                            keys[0xD] = 1;
-                        } break;
-
-                        case SDLK_f:
-                        {
-                            keys[0xE] = 1;
-                        } break;
-
-                        case SDLK_v:
-                        {
-                            keys[0xF] = 1;
-                        } break;
-                    }
-                } break;
-
-                case SDL_KEYUP:
+                    quit = true;
+                }
+                else if (int key = KeypadIndex(event.key.keysym.sym); key >= 0)
                 {
-                    switch (event.key.keysym.sym)
-                    {
-                        case SDLK_x:
-                        {
-                            keys[0] = 0;
-                        } break;
-
-                        case SDLK_1:
-                        {
-                            keys[1] = 0;
-                        } break;
-
-                        case SDLK_2:
-                        {
-                            keys[2] = 0;
-                        } break;
-
-                        case SDLK_3:
-                        {
-                            keys[3] = 0;
-                        } break;
-
-                        case SDLK_q:
-                        {
-                            keys[4] = 0;
-                        } break;
-
-                        case SDLK_w:
-                        {
-                            keys[5] = 0;
-                        } break;
-
-                        case SDLK_e:
-                        {
-                            keys[6] = 0;
-                        } break;
-
-                        case SDLK_a:
-                        {
-                            keys[7] = 0;
-                        } break;
-
-                        case SDLK_s:
-                        {
-                            keys[8] = 0;
-                        } break;
-
-                        case SDLK_d:
-                        {
-                            keys[9] = 0;
-                        } break;
-
-                        case SDLK_z:
-                        {
-                            keys[0xA] = 0;
-                        } break;
-
-                        case SDLK_c:
-                        {
-                            keys[0xB] = 0;
-                        } break;
-
-                        case SDLK_4:
-                        {
-                            keys[0xC] = 0;
-                        } break;
-
-                        case SDLK_r:
-                        {
-                            keys[0xD] = 0;
-                        } break;
-
-                        case SDLK_f:
-                        {
-                            keys[0xE] = 0;
-                        } break;
-
-                        case SDLK_v:
-                        {
-                            keys[0xF] = 0;
-                        } break;
-                    }
-                } break;
-            }
+                    keys |= 1u << key;
+                }
+            } break;
+
+            case SDL_KEYUP:
+            {
+                if (int key = KeypadIndex(event.key.keysym.sym); key >= 0)
+                {
+                    keys &= ~(1u << key);
+                }
+            } break;
         }
 
         return quit;
     }
 
+    // The CHIP-8 key for a keycode, or -1. All the mapped keys are printable ASCII, which
+    // SDL uses as their keycode, so a 128 entry table covers them.
+    int KeypadIndex(SDL_Keycode sym) const
+    {
+        return sym >= 0 && sym < 128 ? keymap[sym] : -1;
+    }
+
+    static int LeadingZeros(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return 63 - static_cast<int>(index);
+#else
+        return __builtin_clzll(value);
+#endif
+    }
+
+    // Turns every run of lit pixels in one word of a row into a rect
+    static void AddRuns(uint64_t bits, int x, int y, std::vector<SDL_Rect>& out) {
+        while (bits) {
+            // Skip the unlit pixels, then measure the lit run that now starts at the top
+            int unlit = LeadingZeros(bits);
+            bits <<= unlit;
+            x += unlit;
+
+            int lit = ~bits ? LeadingZeros(~bits) : 64;
+            bits = lit < 64 ? bits << lit : 0;
+
+            out.push_back({x, y, lit, 1});
+            x += lit;
+        }
+    }
+
+    // Runs on SDL's audio thread, so all it does is take what's in the ring
+    static void SDLCALL AudioCallback(void* userdata, Uint8* stream, int length) {
+        AudioRing& ring = *static_cast<AudioRing*>(userdata);
+        int16_t* samples = reinterpret_cast<int16_t*>(stream);
+        int count = length / static_cast<int>(sizeof(int16_t));
+
+        for (int i = 0; i < count; ++i) {
+            if (!ring.Pop(samples[i])) {
+                samples[i] = 0;
+            }
+        }
+    }
+
+    static void SetDrawColor(SDL_Renderer* renderer, uint32_t color) {
+        SDL_SetRenderDrawColor(renderer, (color >> 16u) & 0xFFu, (color >> 8u) & 0xFFu, color & 0xFFu, 0xFF);
+    }
+
+    void Present() {
+        SetDrawColor(renderer, palette[0]);
+        SDL_RenderClear(renderer);
+
+        for (int color = 0; color < 3; ++color) {
+            SetDrawColor(renderer, palette[color + 1]);
+            SDL_RenderFillRects(renderer, rects[color].data(), static_cast<int>(rects[color].size()));
+        }
+
+        SDL_RenderPresent(renderer);
+    }
 
-private:
     SDL_Window* window{};
     SDL_Renderer* renderer{};
-    SDL_Texture* texture{};
+    SDL_AudioDeviceID audioDevice{};
+
+    int width;
+    int height;
+
+    // Pixels lit on the first plane only, the second only, and both
+    std::vector<SDL_Rect> rects[3];
+
+    // Unlit, then the three above; only the first two show on a single plane display
+    uint32_t palette[4] = {0x000000, 0xFFFFFF, 0xFF6600, 0x662200};
+
+    int8_t keymap[128]{};
 };
 
 
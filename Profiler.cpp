@@ -0,0 +1,132 @@
+//
+// Optional instrumentation around instruction dispatch: execution counts per opcode
+// family, per OP_ function and per address, and a histogram of instruction times.
+//
+
+#include "Profiler.h"
+#include <algorithm>
+#include <vector>
+
+static char const* const HANDLER_NAMES[OpcodeProfiler::HANDLER_COUNT] = {
+        "OP_NULL",
+        "OP_00E0", "OP_00EE", "OP_1nnn", "OP_2nnn", "OP_3xkk", "OP_4xkk", "OP_5xy0",
+        "OP_6xkk", "OP_7xkk", "OP_8xy0", "OP_8xy1", "OP_8xy2", "OP_8xy3", "OP_8xy4",
+        "OP_8xy5", "OP_8xy6", "OP_8xy7", "OP_8xyE", "OP_9xy0", "OP_Annn", "OP_Bnnn",
+        "OP_Cxkk", "OP_Dxyn", "OP_Ex9E", "OP_ExA1", "OP_Fx07", "OP_Fx0A", "OP_Fx15",
+        "OP_Fx18", "OP_Fx1E", "OP_Fx29", "OP_Fx33", "OP_Fx55", "OP_Fx65",
+        "OP_00Cn", "OP_00FB", "OP_00FC", "OP_00FD", "OP_00FE", "OP_00FF", "OP_Fx30",
+        "OP_Fx75", "OP_Fx85",
+        "OP_00Dn", "OP_5xy2", "OP_5xy3", "OP_F000", "OP_Fn01", "OP_Fx02", "OP_Fx3A",
+};
+
+// An opcode each OP_ function above is meant for, in the same order
+static const uint16_t HANDLER_OPCODES[OpcodeProfiler::HANDLER_COUNT] = {
+        0x0000,
+        0x00E0, 0x00EE, 0x1000, 0x2000, 0x3000, 0x4000, 0x5000,
+        0x6000, 0x7000, 0x8000, 0x8001, 0x8002, 0x8003, 0x8004,
+        0x8005, 0x8006, 0x8007, 0x800E, 0x9000, 0xA000, 0xB000,
+        0xC000, 0xD000, 0xE09E, 0xE0A1, 0xF007, 0xF00A, 0xF015,
+        0xF018, 0xF01E, 0xF029, 0xF033, 0xF055, 0xF065,
+        0x00C1, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF, 0xF030,
+        0xF075, 0xF085,
+        0x00D1, 0x5002, 0x5003, 0xF000, 0xF001, 0xF002, 0xF03A,
+};
+
+/* Rather than decoding opcodes a second time, and going stale whenever the tables
+ * change, an opcode is resolved through the profile's own dispatch tables and counted
+ * against the first handler above whose opcode resolves to the same OP_ function. Where
+ * a profile doesn't have an instruction, its opcode resolves to whatever the profile
+ * runs instead (OP_NULL, or 00EE for a classic 00FE), so that's what gets the count.
+ */
+unsigned int OpcodeProfiler::HandlerIndex(Quirks quirks, uint16_t instruction) {
+    Chip8::DispatchTables const& tables = Chip8::dispatchTables[static_cast<unsigned int>(quirks)];
+    Chip8::Chip8Func handler = Chip8::Resolve(tables, instruction);
+
+    if (handler == &Chip8::OP_NULL) {
+        return 0;
+    }
+
+    for (unsigned int i = 1; i < HANDLER_COUNT; ++i) {
+        if (Chip8::Resolve(tables, HANDLER_OPCODES[i]) == handler) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+char const* OpcodeProfiler::HandlerName(unsigned int handler) {
+    return handler < HANDLER_COUNT ? HANDLER_NAMES[handler] : "?";
+}
+
+void OpcodeProfiler::Record(Quirks quirks, uint16_t address, uint16_t instruction, uint64_t nanoseconds) {
+    if (quirks == Quirks::XoChip && addresses.size() < EXTENDED_MEMORY_SIZE) {
+        addresses.resize(EXTENDED_MEMORY_SIZE);
+    }
+
+    ++total;
+    ++families[(instruction & 0xF000u) >> 12u];
+    ++handlers[HandlerIndex(quirks, instruction)];
+    ++addresses[address % addresses.size()];
+
+    unsigned int bucket = 0;
+
+    while (nanoseconds > 0 && bucket < HISTOGRAM_BUCKETS - 1) {
+        nanoseconds >>= 1u;
+        ++bucket;
+    }
+
+    ++histogram[bucket];
+}
+
+void OpcodeProfiler::Report(std::ostream& out, unsigned int hotAddresses) const {
+    out << "instructions " << total << "\n";
+
+    out << "families\n";
+
+    for (unsigned int family = 0; family < 16; ++family) {
+        if (families[family]) {
+            out << "  " << std::hex << std::uppercase << family << std::dec << "xxx " << families[family] << "\n";
+        }
+    }
+
+    out << "handlers\n";
+
+    for (unsigned int handler = 0; handler < HANDLER_COUNT; ++handler) {
+        if (handlers[handler]) {
+            out << "  " << HANDLER_NAMES[handler] << " " << handlers[handler] << "\n";
+        }
+    }
+
+    // Only the hottest few addresses, most executed first
+    std::vector<unsigned int> hottest;
+
+    for (unsigned int address = 0; address < addresses.size(); ++address) {
+        if (addresses[address]) {
+            hottest.push_back(address);
+        }
+    }
+
+    std::sort(hottest.begin(), hottest.end(), [this](unsigned int a, unsigned int b) {
+        return addresses[a] > addresses[b];
+    });
+
+    if (hottest.size() > hotAddresses) {
+        hottest.resize(hotAddresses);
+    }
+
+    out << "addresses\n";
+
+    for (unsigned int address : hottest) {
+        out << "  0x" << std::hex << std::uppercase << address << std::dec << " " << addresses[address] << "\n";
+    }
+
+    out << "histogram (ns)\n";
+
+    for (unsigned int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+        if (histogram[bucket]) {
+            uint64_t upper = bucket == 0 ? 1 : 1ull << bucket;
+            out << "  <" << upper << " " << histogram[bucket] << "\n";
+        }
+    }
+}
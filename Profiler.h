@@ -0,0 +1,103 @@
+//
+// Optional instrumentation around instruction dispatch: execution counts per opcode
+// family, per OP_ function and per address, and a histogram of instruction times.
+//
+
+#include "Chip8.h"
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_PROFILER_H
+#define EMULATOR_CHIP_8_PROFILER_H
+
+
+// PROFILERS
+/* Chip8::RunProfiled() takes the profiler as a template parameter, and whether it does
+ * any profiling at all is decided at compile time from Profiler::enabled. Running with
+ * NullProfiler compiles down to a plain RunFor(), so code can be written against a
+ * profiler type and have it cost nothing in builds that pick the null one.
+ */
+struct NullProfiler {
+    static constexpr bool enabled = false;
+
+    void Record(Quirks, uint16_t, uint16_t, uint64_t) {}
+};
+
+class OpcodeProfiler {
+public:
+    static constexpr bool enabled = true;
+
+    // One per OP_ function, plus one for opcodes that end up in OP_NULL
+    static const unsigned int HANDLER_COUNT = 51;
+
+    // Instruction times go into power-of-two buckets of nanoseconds: bucket n holds times
+    // from 2^(n-1) up to 2^n, with bucket 0 for anything under a nanosecond
+    static const unsigned int HISTOGRAM_BUCKETS = 32;
+
+    // The address is the PC as the machine's memory wraps it, so under XO-CHIP anywhere
+    // in its 64KB
+    void Record(Quirks quirks, uint16_t address, uint16_t instruction, uint64_t nanoseconds);
+
+    // Human readable summary: families, handlers, the hottest addresses and the histogram
+    void Report(std::ostream& out, unsigned int hotAddresses = 16) const;
+
+    // Which OP_ function the profile's dispatch tables send an opcode to
+    static unsigned int HandlerIndex(Quirks quirks, uint16_t instruction);
+    static char const* HandlerName(unsigned int handler);
+
+    uint64_t total{};
+    uint64_t families[16]{};
+    uint64_t handlers[HANDLER_COUNT]{};
+    // Grown to the memory of the biggest profile recorded
+    std::vector<uint64_t> addresses = std::vector<uint64_t>(MEMORY_SIZE);
+    uint64_t histogram[HISTOGRAM_BUCKETS]{};
+};
+
+template <typename Profiler>
+unsigned int Chip8::RunProfiled(unsigned int cycles, Profiler& profiler) {
+    if constexpr (!Profiler::enabled) {
+        return RunFor(cycles);
+    } else {
+        // Instructions are timed one at a time, so the recompiler is stepped through its
+        // blocks on the table path here; every other engine runs as it normally would
+        auto step = [this, &profiler] {
+            uint16_t address = pc & addressMask;
+            uint16_t instruction = (memory[pc & addressMask] << 8u) | memory[(pc + 1u) & addressMask];
+
+            auto startTime = std::chrono::steady_clock::now();
+
+            switch (dispatch) {
+                case Dispatch::Table:
+                case Dispatch::Recompiler:
+                    CycleTable();
+                    break;
+                case Dispatch::Switch:
+                    CycleSwitch();
+                    break;
+                case Dispatch::Cached:
+                    CycleCached();
+                    break;
+            }
+
+            auto endTime = std::chrono::steady_clock::now();
+
+            profiler.Record(quirks, address, instruction,
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count());
+        };
+
+        return RunBudget(cycles, [this, &step](unsigned int budget) {
+            unsigned int executed = 0;
+
+            for (; executed < budget && !waitingForKey && !idleLoop; ++executed) {
+                step();
+            }
+
+            return executed;
+        });
+    }
+}
+
+
+#endif //EMULATOR_CHIP_8_PROFILER_H
@@ -0,0 +1,103 @@
+//
+// Which quirks profile each known ROM needs, looked up by a hash of its bytes.
+//
+
+#include "QuirksDatabase.h"
+#include <fstream>
+#include <sstream>
+
+struct QuirksNameEntry {
+    char const* name;
+    Quirks quirks;
+};
+
+static const QuirksNameEntry QUIRKS_NAMES[] = {
+        {"modern", Quirks::Modern},
+        {"cosmac", Quirks::Cosmac},
+        {"superchip", Quirks::SuperChip},
+        {"xochip", Quirks::XoChip},
+};
+
+bool ParseQuirks(std::string const& name, Quirks& quirks) {
+    for (QuirksNameEntry const& entry : QUIRKS_NAMES) {
+        if (name == entry.name) {
+            quirks = entry.quirks;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+char const* QuirksName(Quirks quirks) {
+    for (QuirksNameEntry const& entry : QUIRKS_NAMES) {
+        if (entry.quirks == quirks) {
+            return entry.name;
+        }
+    }
+
+    return "unknown";
+}
+
+bool QuirksDatabase::Load(char const* filename) {
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    profiles.clear();
+
+    std::string line;
+
+    while (std::getline(file, line)) {
+        // Drop comments
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        uint64_t hash;
+        std::string name;
+
+        if (!(fields >> std::hex >> hash)) {
+            // Nothing but whitespace on this line, unless it's garbage
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                return false;
+            }
+
+            continue;
+        }
+
+        Quirks quirks;
+
+        if (!(fields >> name) || !ParseQuirks(name, quirks)) {
+            return false;
+        }
+
+        profiles[hash] = quirks;
+    }
+
+    return true;
+}
+
+bool QuirksDatabase::Find(RomSpan rom, Quirks& quirks) const {
+    auto found = profiles.find(RomHash(rom));
+
+    if (found == profiles.end()) {
+        return false;
+    }
+
+    quirks = found->second;
+
+    return true;
+}
+
+uint64_t QuirksDatabase::RomHash(RomSpan rom) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (size_t i = 0; i < rom.size; ++i) {
+        hash ^= rom.data[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
@@ -0,0 +1,47 @@
+//
+// Which quirks profile each known ROM needs, looked up by a hash of its bytes.
+//
+
+#include "Chip8.h"
+#include "RomLibrary.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#ifndef EMULATOR_CHIP_8_QUIRKSDATABASE_H
+#define EMULATOR_CHIP_8_QUIRKSDATABASE_H
+
+
+// Profile names as they appear on the command line and in the database: modern, cosmac,
+// superchip and xochip
+bool ParseQuirks(std::string const& name, Quirks& quirks);
+char const* QuirksName(Quirks quirks);
+
+// QUIRKS DATABASE
+/* A text file with one ROM per line:
+ *
+ *     <hash> <profile>
+ *
+ * where the hash is RomHash() of the ROM file in hex and the profile one of the names
+ * above. Blank lines and anything after a # are ignored, so the rest of a line is a good
+ * place for the ROM's name. Hashing the contents rather than going by file name finds a
+ * ROM however it was renamed, and tells apart different revisions of the same game.
+ */
+class QuirksDatabase {
+public:
+    bool Load(char const* filename);
+
+    // False, leaving quirks alone, for a ROM that isn't in the database
+    bool Find(RomSpan rom, Quirks& quirks) const;
+
+    size_t Size() const { return profiles.size(); }
+
+    // FNV-1a over the ROM's bytes
+    static uint64_t RomHash(RomSpan rom);
+
+private:
+    std::unordered_map<uint64_t, Quirks> profiles;
+};
+
+
+#endif //EMULATOR_CHIP_8_QUIRKSDATABASE_H
@@ -0,0 +1,106 @@
+//
+// Random number generators for OP_Cxkk.
+//
+
+#include <cstdint>
+
+#ifndef EMULATOR_CHIP_8_RANDOM_H
+#define EMULATOR_CHIP_8_RANDOM_H
+
+
+// RANDOM NUMBER GENERATORS
+/* OP_Cxkk only ever needs one random byte, so a generator here is anything with:
+ *
+ *     void Seed(uint64_t seed);      start a new sequence
+ *     uint8_t NextByte();            the next byte in the sequence
+ *     uint64_t State() const;        everything needed to resume the sequence...
+ *     void SetState(uint64_t state); ...and putting it back
+ *
+ * The whole state has to fit in 64 bits so that it can go into a save state, which is
+ * what makes a loaded state produce the same random numbers the original run did.
+ * Chip8::Random picks which one the emulator uses.
+ */
+
+// PCG32
+/* The permuted congruential generator (O'Neill, pcg-random.org), 32-bit output from 64
+ * bits of state. One multiply-add per number plus a shift and a rotate on the way out,
+ * which is cheaper than the standard library's engines and much better distributed than
+ * an LCG's low bits. The bytes are taken from the top of the output, which is the best
+ * mixed part.
+ */
+class Pcg32 {
+public:
+    void Seed(uint64_t seed) {
+        state = 0;
+        Next();
+        state += seed;
+        Next();
+    }
+
+    uint8_t NextByte() {
+        return static_cast<uint8_t>(Next() >> 24u);
+    }
+
+    uint64_t State() const {
+        return state;
+    }
+
+    void SetState(uint64_t newState) {
+        state = newState;
+    }
+
+private:
+    static const uint64_t MULTIPLIER = 6364136223846793005ull;
+    static const uint64_t INCREMENT = 1442695040888963407ull;
+
+    uint32_t Next() {
+        uint64_t oldState = state;
+        state = oldState * MULTIPLIER + INCREMENT;
+
+        uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+        uint32_t rotation = static_cast<uint32_t>(oldState >> 59u);
+
+        return (xorShifted >> rotation) | (xorShifted << ((32u - rotation) & 31u));
+    }
+
+    uint64_t state{};
+};
+
+// XORSHIFT64*
+/* Marsaglia's xorshift with a multiply on the output (Vigna). Three shifts, three XORs and
+ * a multiply. The state must never be zero, so seeding mixes the seed through SplitMix64
+ * first, which also spreads nearby seeds far apart.
+ */
+class Xorshift64Star {
+public:
+    void Seed(uint64_t seed) {
+        uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+        z ^= z >> 31u;
+
+        state = z ? z : 1;
+    }
+
+    uint8_t NextByte() {
+        state ^= state >> 12u;
+        state ^= state << 25u;
+        state ^= state >> 27u;
+
+        return static_cast<uint8_t>((state * 0x2545F4914F6CDD1Dull) >> 56u);
+    }
+
+    uint64_t State() const {
+        return state;
+    }
+
+    void SetState(uint64_t newState) {
+        state = newState ? newState : 1;
+    }
+
+private:
+    uint64_t state = 1;
+};
+
+
+#endif //EMULATOR_CHIP_8_RANDOM_H
@@ -0,0 +1,152 @@
+//
+// Frame-by-frame history of the machine, for stepping back in time.
+//
+
+#include "Rewind.h"
+#include "DeltaCoding.h"
+#include <cstring>
+
+Rewind::Rewind(size_t capacity, unsigned int keyframeInterval)
+    : ring(capacity), keyframeInterval(keyframeInterval) {
+}
+
+void Rewind::Push(Chip8 const& chip8) {
+    state.clear();
+    chip8.SaveState(state);
+
+    bool needKeyframe = !haveKeyframe || nextSequence - keyframeSequence >= keyframeInterval
+                        || keyframe.size() != state.size();
+
+    if (!needKeyframe) {
+        record.clear();
+        EncodeDelta(keyframe.data(), state.data(), state.size(), record);
+
+        // Making room can push out the keyframe this delta was made against, in which
+        // case it's no use and the frame goes in as a new keyframe instead
+        if (Store(record, keyframeSequence)) {
+            return;
+        }
+    }
+
+    keyframe = state;
+    keyframeSequence = nextSequence;
+    haveKeyframe = Store(keyframe, keyframeSequence);
+}
+
+bool Rewind::Pop(Chip8& chip8) {
+    if (entries.empty()) {
+        return false;
+    }
+
+    Entry const entry = entries.back();
+
+    LoadKeyframe(entries[entry.keyframe - entries.front().sequence]);
+
+    if (entry.keyframe != entry.sequence) {
+        DecodeDelta(ring.data() + entry.offset, entry.size, state.data());
+    }
+
+    bool loaded = chip8.LoadState(state.data(), state.size());
+
+    // Its space is free again, and new frames take its place in the sequence
+    entries.pop_back();
+    head = entry.offset;
+    nextSequence = entry.sequence;
+
+    // Frames pushed from here on carry on from the keyframe of the one just popped, as
+    // long as that wasn't the keyframe itself
+    bool resume = entry.keyframe != entry.sequence;
+
+    if (resume && !(haveKeyframe && keyframeSequence == entry.keyframe)) {
+        LoadKeyframe(entries[entry.keyframe - entries.front().sequence]);
+        keyframe.swap(state);
+        keyframeSequence = entry.keyframe;
+    }
+
+    haveKeyframe = resume;
+
+    return loaded;
+}
+
+void Rewind::Clear() {
+    entries.clear();
+    head = 0;
+    haveKeyframe = false;
+}
+
+size_t Rewind::BytesUsed() const {
+    size_t used = 0;
+
+    for (Entry const& entry : entries) {
+        used += entry.size;
+    }
+
+    return used;
+}
+
+bool Rewind::Store(std::vector<uint8_t> const& data, uint64_t dataKeyframe) {
+    size_t size = data.size();
+
+    if (size > ring.size()) {
+        Clear();
+        return false;
+    }
+
+    /* Records go in one after the other and wrap to the start when the next one doesn't
+     * fit before the end. The frames in the way are always the oldest ones, including
+     * any left in the stretch at the end that gets skipped over when wrapping.
+     */
+    bool wrap = head + size > ring.size();
+    size_t start = wrap ? 0 : head;
+
+    while (!entries.empty()) {
+        Entry const& oldest = entries.front();
+
+        bool skipped = wrap && oldest.offset >= head;
+        bool overlaps = oldest.offset < start + size && oldest.offset + oldest.size > start;
+
+        if (!skipped && !overlaps) {
+            break;
+        }
+
+        EvictOldest();
+    }
+
+    if (dataKeyframe != nextSequence && (entries.empty() || entries.front().sequence > dataKeyframe)) {
+        return false;
+    }
+
+    memcpy(ring.data() + start, data.data(), size);
+    entries.push_back({start, size, nextSequence, dataKeyframe});
+
+    head = start + size;
+    ++nextSequence;
+
+    return true;
+}
+
+void Rewind::EvictOldest() {
+    uint64_t dropped = entries.front().sequence;
+    bool wasKeyframe = entries.front().keyframe == dropped;
+
+    entries.pop_front();
+
+    if (!wasKeyframe) {
+        return;
+    }
+
+    // Nothing encoded against it can be decoded any more
+    while (!entries.empty() && entries.front().keyframe == dropped) {
+        entries.pop_front();
+    }
+
+    if (keyframeSequence == dropped) {
+        haveKeyframe = false;
+    }
+}
+
+void Rewind::LoadKeyframe(Entry const& entry) {
+    uint8_t const* data = ring.data() + entry.offset;
+
+    state.assign(data, data + entry.size);
+}
@@ -0,0 +1,71 @@
+//
+// Frame-by-frame history of the machine, for stepping back in time.
+//
+
+#include "Chip8.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_REWIND_H
+#define EMULATOR_CHIP_8_REWIND_H
+
+
+// REWIND BUFFER
+/* Push() takes a save state once per frame and Pop() steps back to the most recent one,
+ * so holding a rewind key walks history backwards a frame at a time.
+ *
+ * A save state is about 4.4KB, but from one frame to the next almost all of it stays the
+ * same: a few registers, a handful of memory bytes and some display rows. So only every
+ * keyframeInterval-th state is kept whole. The ones in between are XORed against that
+ * keyframe, which leaves them almost all zero bytes, and stored as runs of zeros and the
+ * literal bytes between them (see DeltaCoding.h). Any state decodes from its keyframe
+ * plus its own delta, so stepping back never has to replay a chain of deltas.
+ *
+ * Everything lives in one ring of capacity bytes allocated up front. When it fills up,
+ * the oldest frames are dropped to make room, along with every delta that depended on a
+ * keyframe that was dropped.
+ */
+class Rewind {
+public:
+    explicit Rewind(size_t capacity, unsigned int keyframeInterval = 60);
+
+    void Push(Chip8 const& chip8);
+    bool Pop(Chip8& chip8);
+    void Clear();
+
+    size_t Frames() const { return entries.size(); }
+    size_t BytesUsed() const;
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t size;
+        uint64_t sequence;
+        uint64_t keyframe;
+    };
+
+    bool Store(std::vector<uint8_t> const& record, uint64_t keyframe);
+    void EvictOldest();
+    void LoadKeyframe(Entry const& entry);
+
+    std::vector<uint8_t> ring;
+    size_t head{};
+    std::deque<Entry> entries;
+    uint64_t nextSequence{};
+
+    unsigned int keyframeInterval;
+
+    // The keyframe new deltas are encoded against, decoded, and how many frames ago it was
+    bool haveKeyframe{};
+    uint64_t keyframeSequence{};
+    std::vector<uint8_t> keyframe;
+
+    // Scratch buffers, kept around so a frame doesn't allocate once they've grown
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> record;
+};
+
+
+#endif //EMULATOR_CHIP_8_REWIND_H
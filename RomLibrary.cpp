@@ -0,0 +1,184 @@
+//
+// Memory-mapped ROM files, so loading a ROM is a single copy out of the page cache.
+//
+
+#include "RomLibrary.h"
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(char const* filename) {
+    Close();
+
+    HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(handle, &fileSize)) {
+        CloseHandle(handle);
+        return false;
+    }
+
+    file = handle;
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    // Empty files can't be mapped, but they are still perfectly good (empty) ROMs
+    if (size == 0) {
+        return true;
+    }
+
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapping == nullptr) {
+        Close();
+        return false;
+    }
+
+    data = static_cast<uint8_t const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (data == nullptr) {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+    }
+
+    if (file != nullptr) {
+        CloseHandle(file);
+    }
+
+    data = nullptr;
+    size = 0;
+    mapping = nullptr;
+    file = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(char const* filename) {
+    Close();
+
+    int descriptor = open(filename, O_RDONLY);
+
+    if (descriptor < 0) {
+        return false;
+    }
+
+    struct stat status{};
+
+    if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close(descriptor);
+        return false;
+    }
+
+    size = static_cast<size_t>(status.st_size);
+
+    // Empty files can't be mapped, but they are still perfectly good (empty) ROMs
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+        if (mapped == MAP_FAILED) {
+            close(descriptor);
+            size = 0;
+            return false;
+        }
+
+        data = static_cast<uint8_t const*>(mapped);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(descriptor);
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != nullptr) {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+
+    data = nullptr;
+    size = 0;
+}
+
+#endif
+
+bool RomLibrary::Open(char const* directory) {
+    std::error_code error;
+
+    for (auto const& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (!entry.is_regular_file(error)) {
+            continue;
+        }
+
+        if (!Add(entry.path().filename().string(), entry.path().string().c_str())) {
+            return false;
+        }
+    }
+
+    return !error;
+}
+
+bool RomLibrary::Add(std::string const& name, char const* filename) {
+    std::unique_ptr<MappedFile> file(new MappedFile);
+
+    if (!file->Open(filename)) {
+        return false;
+    }
+
+    byName[name] = files.size();
+    files.push_back(std::move(file));
+
+    return true;
+}
+
+bool RomLibrary::Find(std::string const& name, RomSpan& rom) const {
+    auto found = byName.find(name);
+
+    if (found == byName.end()) {
+        return false;
+    }
+
+    rom = files[found->second]->Span();
+
+    return true;
+}
+
+std::vector<std::string> RomLibrary::Names() const {
+    std::vector<std::string> names;
+    names.reserve(byName.size());
+
+    for (auto const& rom : byName) {
+        names.push_back(rom.first);
+    }
+
+    return names;
+}
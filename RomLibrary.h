@@ -0,0 +1,73 @@
+//
+// Memory-mapped ROM files, so loading a ROM is a single copy out of the page cache.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_ROMLIBRARY_H
+#define EMULATOR_CHIP_8_ROMLIBRARY_H
+
+
+// A read-only view of ROM bytes that somebody else owns
+struct RomSpan {
+    uint8_t const* data;
+    size_t size;
+};
+
+// MAPPED FILE
+/* Maps a whole file into memory read-only for as long as the object lives. Spans handed
+ * out by Span() point straight into the mapping and are only valid until it is closed.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    bool Open(char const* filename);
+    void Close();
+
+    RomSpan Span() const { return {data, size}; }
+
+private:
+    uint8_t const* data{};
+    size_t size{};
+
+#ifdef _WIN32
+    void* file{};
+    void* mapping{};
+#endif
+};
+
+// ROM LIBRARY
+/* Maps every regular file in a directory once, up front, and hands out spans of them by
+ * file name. Meant for batch runs that load the same few thousand ROMs over and over:
+ * after Open() no lookup touches the file system again. Add() maps a single file under
+ * whatever name it's given, for ROMs that don't share a directory.
+ */
+class RomLibrary {
+public:
+    bool Open(char const* directory);
+    bool Add(std::string const& name, char const* filename);
+
+    // False, leaving rom alone, if there's no ROM by that name. An empty file is found,
+    // with an empty span.
+    bool Find(std::string const& name, RomSpan& rom) const;
+
+    std::vector<std::string> Names() const;
+
+private:
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::unordered_map<std::string, size_t> byName;
+};
+
+
+#endif //EMULATOR_CHIP_8_ROMLIBRARY_H
@@ -0,0 +1,79 @@
+//
+// Lock-free queue between exactly one producer thread and one consumer thread.
+//
+
+#include <atomic>
+#include <cstddef>
+
+#ifndef EMULATOR_CHIP_8_SPSCQUEUE_H
+#define EMULATOR_CHIP_8_SPSCQUEUE_H
+
+
+// SPSC QUEUE
+/* A fixed ring of Capacity slots (a power of two) with a head only the consumer moves and
+ * a tail only the producer moves. Neither side ever blocks: Push() fails when the ring is
+ * full and Pop() fails when it's empty, and it's up to the caller what to do then.
+ *
+ * The head and tail only ever count up and are masked into the ring, so full and empty
+ * are told apart by their difference. Each side keeps a copy of the other's index and
+ * only reloads it when the copy says the ring is full or empty, which keeps the shared
+ * cache lines from bouncing between cores on every call.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool Push(T const& value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+
+        if (position - headCache == Capacity) {
+            headCache = head.load(std::memory_order_acquire);
+
+            if (position - headCache == Capacity) {
+                return false;
+            }
+        }
+
+        slots[position & (Capacity - 1)] = value;
+        tail.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool Pop(T& value) {
+        size_t position = head.load(std::memory_order_relaxed);
+
+        if (position == tailCache) {
+            tailCache = tail.load(std::memory_order_acquire);
+
+            if (position == tailCache) {
+                return false;
+            }
+        }
+
+        value = slots[position & (Capacity - 1)];
+        head.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // How many values are waiting, as of some moment during the call
+    size_t Size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    T slots[Capacity]{};
+
+    // Consumer's line
+    alignas(64) std::atomic<size_t> head{0};
+    size_t tailCache = 0;
+
+    // Producer's line
+    alignas(64) std::atomic<size_t> tail{0};
+    size_t headCache = 0;
+};
+
+
+#endif //EMULATOR_CHIP_8_SPSCQUEUE_H
@@ -0,0 +1,104 @@
+//
+// A small work-stealing thread pool for running independent jobs on every core.
+//
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount) : queues(threadCount > 0 ? threadCount : 1) {
+    for (unsigned int i = 0; i < queues.size(); ++i) {
+        workers.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    taskReady.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    Queue& queue = queues[nextQueue++ % queues.size()];
+
+    unfinished++;
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        // Taking the lock makes sure a worker about to sleep sees the new task
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+
+    taskReady.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    allDone.wait(lock, [this] { return unfinished == 0; });
+}
+
+bool ThreadPool::TakeTask(unsigned int self, std::function<void()>& task) {
+    // Newest task from our own queue first, it's the most likely to still be warm
+    {
+        Queue& own = queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Then the oldest task of anyone else
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& victim = queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::Work(unsigned int self) {
+    while (true) {
+        std::function<void()> task;
+
+        if (TakeTask(self, task)) {
+            queued--;
+
+            task();
+
+            if (--unfinished == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                allDone.notify_all();
+            }
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        taskReady.wait(lock, [this] { return stopping || queued > 0; });
+
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
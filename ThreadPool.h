@@ -0,0 +1,64 @@
+//
+// A small work-stealing thread pool for running independent jobs on every core.
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef EMULATOR_CHIP_8_THREADPOOL_H
+#define EMULATOR_CHIP_8_THREADPOOL_H
+
+
+// THREAD POOL
+/* Every worker owns a queue of tasks. Submit() deals tasks out to the queues in turn, and
+ * a worker takes from the back of its own queue first. Once that runs dry it steals from
+ * the front of the others, so a worker that drew a handful of long jobs doesn't hold up
+ * the rest of the batch while the other workers sit idle.
+ *
+ * Wait() blocks until every task submitted so far has finished.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threadCount);
+
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    void Submit(std::function<void()> task);
+    void Wait();
+
+    unsigned int Size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void Work(unsigned int self);
+    bool TakeTask(unsigned int self, std::function<void()>& task);
+
+    std::vector<std::thread> workers;
+    std::vector<Queue> queues;
+
+    // Guards sleeping and waking only; the queues have their own locks
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable allDone;
+
+    std::atomic<unsigned int> nextQueue{0};
+    // Can dip below zero for a moment when a task is taken before Submit() counts it
+    std::atomic<long> queued{0};
+    std::atomic<size_t> unfinished{0};
+    bool stopping = false;
+};
+
+
+#endif //EMULATOR_CHIP_8_THREADPOOL_H
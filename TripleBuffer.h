@@ -0,0 +1,61 @@
+//
+// Lock-free hand-off of whole frames from one thread to another.
+//
+
+#include <atomic>
+
+#ifndef EMULATOR_CHIP_8_TRIPLEBUFFER_H
+#define EMULATOR_CHIP_8_TRIPLEBUFFER_H
+
+
+// TRIPLE BUFFER
+/* One producer fills Back() and Publish()es it, one consumer calls Update() and reads
+ * Front(). There are three buffers: one each that the producer and consumer own outright,
+ * and one in the middle that they swap theirs with, so neither ever waits on the other.
+ * A producer that's faster than the consumer just overwrites the middle one, and the
+ * consumer always gets the newest finished frame, skipping any it was too slow for.
+ *
+ * The middle's index and whether it holds a frame the consumer hasn't seen yet share a
+ * single atomic, so each swap is a single exchange.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer side
+    T& Back() {
+        return buffers[back];
+    }
+
+    void Publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Consumer side: take the newest frame if there is one, and say whether there was
+    bool Update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+
+        return true;
+    }
+
+    T const& Front() const {
+        return buffers[front];
+    }
+
+private:
+    static const unsigned int INDEX = 0x3u;
+    static const unsigned int FRESH = 0x4u;
+
+    T buffers[3]{};
+
+    // Each side's index on its own cache line, so they don't slow each other down
+    alignas(64) unsigned int back = 0;
+    alignas(64) std::atomic<unsigned int> middle{1};
+    alignas(64) unsigned int front = 2;
+};
+
+
+#endif //EMULATOR_CHIP_8_TRIPLEBUFFER_H
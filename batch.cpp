@@ -0,0 +1,97 @@
+//
+// Runs a whole file of headless ROM jobs across every core and reports how each one
+// ended up, plus the combined instructions per second. Instructions skipped over in idle
+// loops and key waits are reported apart from the ones really run, and ips only counts
+// the ones really run.
+//
+// --quirks and --quirks-db work as they do for headless: each ROM is looked up in the
+// quirks database, falling back to --quirks (or modern) if it isn't there.
+//
+
+#include "BatchRunner.h"
+#include "QuirksDatabase.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+const uint64_t INSTRUCTIONS_PER_SECOND = 700;
+
+int main(int argc, char** argv) {
+    Quirks quirks = Quirks::Modern;
+    char const* quirksFilename = nullptr;
+
+    while (argc > 2 && (std::strcmp(argv[1], "--quirks") == 0 || std::strcmp(argv[1], "--quirks-db") == 0)) {
+        if (std::strcmp(argv[1], "--quirks") == 0) {
+            if (!ParseQuirks(argv[2], quirks)) {
+                std::cerr << "Unknown quirks profile " << argv[2] << "\n";
+                std::exit(EXIT_FAILURE);
+            }
+        } else {
+            quirksFilename = argv[2];
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc != 2 && argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " [--quirks <Profile>] [--quirks-db <File>] <JobFile> [Threads]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    QuirksDatabase database;
+
+    if (quirksFilename && !database.Load(quirksFilename)) {
+        std::cerr << "Could not read quirks database " << quirksFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<BatchJob> jobs;
+
+    if (!LoadBatchJobs(argv[1], jobs)) {
+        std::cerr << "Could not read job file " << argv[1] << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    unsigned int threadCount = argc == 3 ? std::stoi(argv[2]) : std::thread::hardware_concurrency();
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<BatchResult> results = RunBatch(jobs, threadCount, INSTRUCTIONS_PER_SECOND, quirks,
+                                                quirksFilename ? &database : nullptr);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    uint64_t instructions = 0;
+    uint64_t skipped = 0;
+    size_t failed = 0;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        BatchResult const& result = results[i];
+
+        if (!result.ok) {
+            std::cout << jobs[i].rom << " error " << result.error << "\n";
+            ++failed;
+            continue;
+        }
+
+        instructions += result.executed;
+        skipped += result.skipped;
+
+        std::cout << jobs[i].rom << " " << result.executed << " " << result.skipped << " "
+                  << std::hex << std::setw(16) << std::setfill('0') << result.videoHash << std::dec
+                  << " " << result.seconds << "\n";
+    }
+
+    uint64_t run = instructions - skipped;
+
+    std::cout << "jobs " << jobs.size() << " failed " << failed << " instructions " << instructions
+              << " skipped " << skipped << " seconds " << seconds
+              << " ips " << static_cast<uint64_t>(run / seconds) << "\n";
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,274 @@
+//
+// Micro-benchmarks for the interpreter: the cost of every OP_ function on each dispatch
+// engine, OP_Dxyn draws per second by sprite height, and instructions per second on
+// whatever ROMs are passed on the command line, plus the same opcodes run across many
+// lockstep lanes at once. Results are printed as one JSON object per line so they can be
+// collected and compared from run to run.
+//
+
+#include "Chip8.h"
+#include "Chip8Lanes.h"
+#include "RomLibrary.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+const unsigned int BENCH_CYCLES = 2000000;
+const unsigned int BENCH_REPEATS = 5;
+
+// How many machines the lockstep benchmark runs side by side
+const size_t BENCH_LANES = 64;
+
+// Where the loop under test starts, and where helpers live in memory
+const uint16_t LOOP_ADDRESS = 0x200;
+const uint16_t SUBROUTINE_ADDRESS = 0xE00;
+const uint16_t SCRATCH_ADDRESS = 0x800;
+
+struct Engine {
+    char const* name;
+    Dispatch dispatch;
+};
+
+const Engine ENGINES[] = {
+        {"table", Dispatch::Table},
+        {"switch", Dispatch::Switch},
+        {"cached", Dispatch::Cached},
+        {"recompiler", Dispatch::Recompiler},
+};
+
+// OPCODE BENCHMARK
+/* A program that runs one instruction over and over: the setup runs once, then the body
+ * is repeated to fill most of a loop that jumps back to its own start. The loop ends in
+ * two jumps, so a skip instruction landing on the first still loops.
+ */
+struct OpcodeBench {
+    char const* name;
+    std::vector<uint16_t> setup;
+    uint16_t body;
+};
+
+const unsigned int BODY_REPEATS = 64;
+
+static std::vector<OpcodeBench> OpcodeBenches() {
+    uint16_t scratch = 0xA000u | SCRATCH_ADDRESS;
+
+    return {
+            {"OP_00E0", {}, 0x00E0},
+            {"OP_1nnn", {}, 0x1000u | LOOP_ADDRESS},
+            // Every call returns straight away, so this times a call and a return together
+            {"OP_2nnn+OP_00EE", {}, 0x2000u | SUBROUTINE_ADDRESS},
+            {"OP_3xkk", {}, 0x3001},
+            {"OP_4xkk", {}, 0x4000},
+            {"OP_5xy0", {}, 0x5010},
+            {"OP_6xkk", {}, 0x6012},
+            {"OP_7xkk", {}, 0x7001},
+            {"OP_8xy0", {0x6105}, 0x8010},
+            {"OP_8xy1", {0x6105}, 0x8011},
+            {"OP_8xy2", {0x6105}, 0x8012},
+            {"OP_8xy3", {0x6105}, 0x8013},
+            {"OP_8xy4", {0x6105}, 0x8014},
+            {"OP_8xy5", {0x6105}, 0x8015},
+            {"OP_8xy6", {0x6105}, 0x8016},
+            {"OP_8xy7", {0x6105}, 0x8017},
+            {"OP_8xyE", {0x6105}, 0x801E},
+            {"OP_9xy0", {0x6105}, 0x9010},
+            {"OP_Annn", {}, scratch},
+            // V0 stays 0, so this jumps back to the start of the loop
+            {"OP_Bnnn", {}, static_cast<uint16_t>(0xB000u | LOOP_ADDRESS)},
+            {"OP_Cxkk", {}, 0xC0FF},
+            {"OP_Dxyn", {0x6010, 0x6108, 0xA050}, 0xD015},
+            {"OP_Ex9E", {}, 0xE09E},
+            {"OP_ExA1", {}, 0xE0A1},
+            {"OP_Fx07", {}, 0xF007},
+            // Key 0 is held down for the whole run, so the wait never blocks
+            {"OP_Fx0A", {}, 0xF00A},
+            {"OP_Fx15", {}, 0xF015},
+            {"OP_Fx18", {}, 0xF018},
+            // Adding 0 so I never walks off the end of memory
+            {"OP_Fx1E", {0x6000}, 0xF01E},
+            {"OP_Fx29", {}, 0xF029},
+            {"OP_Fx33", {scratch}, 0xF033},
+            {"OP_Fx55", {scratch}, 0xFF55},
+            {"OP_Fx65", {scratch}, 0xFE65},
+    };
+}
+
+static std::vector<uint8_t> BuildProgram(std::vector<uint16_t> const& setup, uint16_t body) {
+    std::vector<uint8_t> program;
+
+    auto emit = [&program](uint16_t instruction) {
+        program.push_back(instruction >> 8u);
+        program.push_back(instruction & 0xFFu);
+    };
+
+    for (uint16_t instruction : setup) {
+        emit(instruction);
+    }
+
+    uint16_t loop = LOOP_ADDRESS + program.size();
+
+    // A body that jumps on its own (1nnn, Bnnn) jumps to the loop, not the program start
+    if ((body & 0xF000u) == 0x1000u || (body & 0xF000u) == 0xB000u) {
+        body = (body & 0xF000u) | loop;
+    }
+
+    for (unsigned int i = 0; i < BODY_REPEATS; ++i) {
+        emit(body);
+    }
+
+    emit(0x1000u | loop);
+    emit(0x1000u | loop);
+
+    return program;
+}
+
+static std::unique_ptr<Chip8> MakeChip8(Dispatch dispatch, std::vector<uint8_t> const& program) {
+    std::unique_ptr<Chip8> chip8(new Chip8(dispatch));
+
+    chip8->LoadROM(program.data(), program.size());
+    chip8->memory[SUBROUTINE_ADDRESS] = 0x00;
+    chip8->memory[SUBROUTINE_ADDRESS + 1] = 0xEE;
+    chip8->InvalidateDecoded(SUBROUTINE_ADDRESS, 2);
+    chip8->SetKey(0, true);
+
+    // Skipped idle trips would count as instructions without taking any time
+    chip8->skipIdleLoops = false;
+
+    return chip8;
+}
+
+// Best of a few runs, in nanoseconds per instruction
+static double TimeRun(Dispatch dispatch, std::vector<uint8_t> const& program, unsigned int cycles) {
+    double best = 0.0;
+
+    for (unsigned int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        std::unique_ptr<Chip8> chip8 = MakeChip8(dispatch, program);
+
+        auto startTime = std::chrono::steady_clock::now();
+        unsigned int executed = chip8->RunFor(cycles);
+        auto endTime = std::chrono::steady_clock::now();
+
+        double nanoseconds = std::chrono::duration<double, std::nano>(endTime - startTime).count() / executed;
+
+        if (repeat == 0 || nanoseconds < best) {
+            best = nanoseconds;
+        }
+    }
+
+    return best;
+}
+
+static void BenchOpcodes() {
+    for (OpcodeBench const& bench : OpcodeBenches()) {
+        std::vector<uint8_t> program = BuildProgram(bench.setup, bench.body);
+
+        for (Engine const& engine : ENGINES) {
+            double nanoseconds = TimeRun(engine.dispatch, program, BENCH_CYCLES);
+
+            std::printf("{\"bench\":\"opcode\",\"name\":\"%s\",\"dispatch\":\"%s\",\"ns_per_op\":%.3f}\n",
+                        bench.name, engine.name, nanoseconds);
+        }
+    }
+}
+
+static void BenchDraws() {
+    // Draws the font's 0 over and over, padded out with however many rows the height asks
+    // for (the bytes after it in memory are the rest of the font)
+    for (uint16_t height = 1; height <= 15; ++height) {
+        std::vector<uint8_t> program = BuildProgram({0x6010, 0x6108, 0xA050}, 0xD010u | height);
+
+        for (Engine const& engine : ENGINES) {
+            double nanoseconds = TimeRun(engine.dispatch, program, BENCH_CYCLES);
+
+            std::printf("{\"bench\":\"draw\",\"height\":%u,\"dispatch\":\"%s\",\"draws_per_second\":%.0f}\n",
+                        height, engine.name, 1e9 / nanoseconds);
+        }
+    }
+}
+
+static void BenchLanes() {
+    /* Lanes have no way to poke at memory after loading, so the subroutine OP_2nnn calls
+     * goes into the ROM itself, padded out to where it lives. Every lane gets the same
+     * program and key 0 held down, so they never diverge and this is the lockstep cost
+     * per instruction per machine.
+     */
+    for (OpcodeBench const& bench : OpcodeBenches()) {
+        std::vector<uint8_t> program = BuildProgram(bench.setup, bench.body);
+
+        program.resize(SUBROUTINE_ADDRESS - LOOP_ADDRESS + 2);
+        program[SUBROUTINE_ADDRESS - LOOP_ADDRESS] = 0x00;
+        program[SUBROUTINE_ADDRESS - LOOP_ADDRESS + 1] = 0xEE;
+
+        unsigned int steps = BENCH_CYCLES / BENCH_LANES * 4;
+        double best = 0.0;
+
+        for (unsigned int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+            std::unique_ptr<Chip8Lanes> lanes(new Chip8Lanes(BENCH_LANES));
+
+            lanes->LoadROM(program.data(), program.size());
+
+            for (size_t lane = 0; lane < BENCH_LANES; ++lane) {
+                lanes->SetKeys(lane, 0x1u);
+            }
+
+            auto startTime = std::chrono::steady_clock::now();
+            lanes->RunFor(steps);
+            auto endTime = std::chrono::steady_clock::now();
+
+            double nanoseconds = std::chrono::duration<double, std::nano>(endTime - startTime).count()
+                                 / (static_cast<double>(steps) * BENCH_LANES);
+
+            if (repeat == 0 || nanoseconds < best) {
+                best = nanoseconds;
+            }
+        }
+
+        std::printf("{\"bench\":\"lanes\",\"name\":\"%s\",\"lanes\":%zu,\"ns_per_op\":%.3f}\n",
+                    bench.name, BENCH_LANES, best);
+    }
+}
+
+static bool BenchRom(char const* filename) {
+    MappedFile file;
+
+    if (!file.Open(filename)) {
+        std::cerr << "Could not open ROM " << filename << "\n";
+        return false;
+    }
+
+    std::vector<uint8_t> program(file.Span().data, file.Span().data + file.Span().size);
+
+    for (Engine const& engine : ENGINES) {
+        double nanoseconds = TimeRun(engine.dispatch, program, BENCH_CYCLES);
+
+        std::printf("{\"bench\":\"rom\",\"rom\":\"%s\",\"dispatch\":\"%s\",\"instructions_per_second\":%.0f}\n",
+                    filename, engine.name, 1e9 / nanoseconds);
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && (std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0)) {
+        std::cerr << "Usage: " << argv[0] << " [ROM...]\n";
+        return EXIT_SUCCESS;
+    }
+
+    BenchOpcodes();
+    BenchDraws();
+    BenchLanes();
+
+    bool ok = true;
+
+    for (int i = 1; i < argc; ++i) {
+        ok = BenchRom(argv[i]) && ok;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,125 @@
+//
+// Runs a ROM without a window: no SDL, no timing, just a fixed number of instructions
+// with optional scripted input, then prints a hash of the final frame. With --profile it
+// also reports where the time went on stderr.
+//
+// Given a script recorded by the emulator, this replays the session as fast as the host
+// can go: the script carries the seed and speed it was recorded with, and a cycle count
+// of 0 runs it to where the recording ended.
+//
+// --quirks picks the quirks profile to run with, and --quirks-db looks the ROM up in a
+// quirks database instead, falling back to --quirks (or modern) if it isn't there.
+//
+
+#include "Chip8.h"
+#include "InputScript.h"
+#include "QuirksDatabase.h"
+#include "RomLibrary.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Used when the input script doesn't say how fast it was recorded
+const uint64_t INSTRUCTIONS_PER_SECOND = 700;
+
+int main(int argc, char** argv) {
+    bool profile = false;
+    Quirks quirks = Quirks::Modern;
+    char const* quirksFilename = nullptr;
+
+    while (argc > 1 && std::strncmp(argv[1], "--", 2) == 0) {
+        if (std::strcmp(argv[1], "--profile") == 0) {
+            profile = true;
+            --argc;
+            ++argv;
+            continue;
+        }
+
+        if (argc < 3 || (std::strcmp(argv[1], "--quirks") != 0 && std::strcmp(argv[1], "--quirks-db") != 0)) {
+            break;
+        }
+
+        if (std::strcmp(argv[1], "--quirks") == 0) {
+            if (!ParseQuirks(argv[2], quirks)) {
+                std::cerr << "Unknown quirks profile " << argv[2] << "\n";
+                std::exit(EXIT_FAILURE);
+            }
+        } else {
+            quirksFilename = argv[2];
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--profile] [--quirks <Profile>] [--quirks-db <File>] <ROM> <Cycles> [InputScript]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    char const* romFilename = argv[1];
+    uint64_t cycles = std::stoull(argv[2]);
+
+    InputScript script;
+
+    if (argc == 4 && !script.Load(argv[3])) {
+        std::cerr << "Could not read input script " << argv[3] << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    MappedFile rom;
+    Chip8 chip8;
+
+    if (!rom.Open(romFilename)) {
+        std::cerr << "Could not load ROM " << romFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The profile decides how much memory there is and which font goes in, so it comes first
+    if (quirksFilename) {
+        QuirksDatabase database;
+
+        if (!database.Load(quirksFilename)) {
+            std::cerr << "Could not read quirks database " << quirksFilename << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        database.Find(rom.Span(), quirks);
+    }
+
+    chip8.SetQuirks(quirks);
+
+    if (!chip8.LoadROM(rom.Span().data, rom.Span().size)) {
+        std::cerr << "Could not load ROM " << romFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (script.seeded) {
+        chip8.Seed(script.seed);
+    }
+
+    uint64_t instructionsPerSecond = script.instructionsPerSecond ? script.instructionsPerSecond : INSTRUCTIONS_PER_SECOND;
+
+    if (cycles == 0) {
+        cycles = script.end;
+    }
+
+    uint64_t executed;
+
+    if (profile) {
+        OpcodeProfiler profiler;
+
+        executed = RunScripted(chip8, script, cycles, instructionsPerSecond, profiler);
+
+        profiler.Report(std::cerr);
+    } else {
+        executed = RunScripted(chip8, script, cycles, instructionsPerSecond);
+    }
+
+    std::cout << executed << " " << std::hex << std::setw(16) << std::setfill('0') << chip8.VideoHash() << "\n";
+
+    return 0;
+}
@@ -1,39 +1,346 @@
+//
+// Created by kealm on 7/21/2024.
+//
+
+#include "Beeper.h"
+#include "Chip8.h"
+#include "FrameScheduler.h"
+#include "FrameStream.h"
+#include "InputScript.h"
+#include "Metrics.h"
+#include "Platform.h"
+#include "QuirksDatabase.h"
+#include "Rewind.h"
+#include "RomLibrary.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+
+// About 8MB of rewind history, which is several minutes for most ROMs
+const size_t REWIND_CAPACITY = 8 * 1024 * 1024;
+
+// With --threaded, the window thread sleeps in the event queue for at most this long at
+// a time; new frames and input wake it sooner
+const int WINDOW_WAIT_MS = 100;
+
+// What the window thread sends the emulation thread whenever the input changes
+struct InputMessage {
+    uint16_t keys;
+    bool rewind;
+};
+
+// The display as Chip8 keeps it: at most 4KB a frame to hand over, however big the window
+struct Frame {
+    uint64_t rows[Chip8::MAX_DISPLAY_WORDS];
+    Chip8::Display display;
+};
+
+int main(int argc, char** argv) {
+    // Random numbers come from the clock unless a seed is given, so a session can be
+    // repeated; --record writes the session out as an input script for headless to replay
+    uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
+    char const* recordFilename = nullptr;
+    bool threaded = false;
+
+    // Lit and unlit pixel colors, as 0xRRGGBB
+    uint32_t foreground = 0xFFFFFF;
+    uint32_t background = 0x000000;
+
+    // The quirks profile comes from the database when the ROM is in it, and from --quirks
+    // (or is modern) otherwise
+    Quirks quirks = Quirks::Modern;
+    char const* quirksFilename = nullptr;
+
+    // --stream sends every frame that changed to a file or a viewer, see FrameStream.h
+    char const* streamTarget = nullptr;
+
+    // --metrics writes a line of live counters a second to a file or a listener, see Metrics.h
+    char const* metricsTarget = nullptr;
+
+    while (argc > 1 && std::strncmp(argv[1], "--", 2) == 0) {
+        if (std::strcmp(argv[1], "--threaded") == 0) {
+            threaded = true;
+            --argc;
+            ++argv;
+            continue;
+        }
+
+        if (argc < 3 || (std::strcmp(argv[1], "--seed") != 0 && std::strcmp(argv[1], "--record") != 0
+                         && std::strcmp(argv[1], "--palette") != 0 && std::strcmp(argv[1], "--quirks") != 0
+                         && std::strcmp(argv[1], "--quirks-db") != 0 && std::strcmp(argv[1], "--stream") != 0
+                         && std::strcmp(argv[1], "--metrics") != 0)) {
+            break;
+        }
+
+        if (std::strcmp(argv[1], "--seed") == 0) {
+            seed = std::stoull(argv[2]);
+        } else if (std::strcmp(argv[1], "--palette") == 0) {
+            // RRGGBB:RRGGBB, foreground first
+            std::string palette = argv[2];
+            size_t colon = palette.find(':');
+
+            foreground = std::stoul(palette.substr(0, colon), nullptr, 16);
+
+            if (colon != std::string::npos) {
+                background = std::stoul(palette.substr(colon + 1), nullptr, 16);
+            }
+        } else if (std::strcmp(argv[1], "--quirks") == 0) {
+            if (!ParseQuirks(argv[2], quirks)) {
+                std::cerr << "Unknown quirks profile " << argv[2] << "\n";
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (std::strcmp(argv[1], "--quirks-db") == 0) {
+            quirksFilename = argv[2];
+        } else if (std::strcmp(argv[1], "--stream") == 0) {
+            streamTarget = argv[2];
+        } else if (std::strcmp(argv[1], "--metrics") == 0) {
+            metricsTarget = argv[2];
+        } else {
+            recordFilename = argv[2];
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
 
-int main(int argc, char_ argv) {
     if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>\n";
+        std::cerr << "Usage: " << argv[0]
+                  << " [--seed N] [--record InputScript] [--palette RRGGBB:RRGGBB] [--quirks Profile] [--quirks-db File] [--stream File|tcp://Host:Port] [--metrics File|tcp://Host:Port] [--threaded] <Scale> <InstructionsPerSecond> <ROM>\n";
         std::exit(EXIT_FAILURE);
     }
 
     int videoScale = std::stoi(argv[1]);
-    int cycleDelay = std::stoi(argv[2]);
+    uint64_t instructionsPerSecond = std::stoull(argv[2]);
     char const* romFilename = argv[3];
 
+    // Before the platform, since its audio device plays from the ring until it's closed
+    AudioRing audio;
+
     Platform platform("CHIP-8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
+    platform.SetPalette(foreground, background);
 
+    if (!platform.OpenAudio(audio)) {
+        std::cerr << "No audio: " << SDL_GetError() << "\n";
+    }
+
+    MappedFile rom;
     Chip8 chip8;
-    chip8.LoadROM(romFilename);
 
-    int videoPitch = sizeof(chip8.video[0]) * VIDEO_WIDTH;
+    if (!rom.Open(romFilename)) {
+        std::cerr << "Could not load ROM " << romFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The profile decides how much memory there is and which font goes in, so it comes first
+    if (quirksFilename) {
+        QuirksDatabase database;
+
+        if (!database.Load(quirksFilename)) {
+            std::cerr << "Could not read quirks database " << quirksFilename << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        database.Find(rom.Span(), quirks);
+    }
+
+    chip8.SetQuirks(quirks);
+
+    if (!chip8.LoadROM(rom.Span().data, rom.Span().size)) {
+        std::cerr << "Could not load ROM " << romFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    rom.Close();
+
+    chip8.Seed(seed);
+
+    InputRecorder recorder(seed, instructionsPerSecond);
+    uint64_t executed = 0;
+
+    Rewind rewind(REWIND_CAPACITY);
+
+    FrameScheduler scheduler(instructionsPerSecond);
+
+    Beeper beeper;
+
+    std::unique_ptr<FrameStreamer> stream;
+
+    if (streamTarget) {
+        std::unique_ptr<FrameSink> sink = OpenFrameSink(streamTarget);
+
+        if (!sink) {
+            std::cerr << "Could not open frame stream " << streamTarget << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        // The stream format only has room for the 64x32 display
+        if (chip8.Extended()) {
+            std::cerr << "Not streaming frames: the " << QuirksName(quirks) << " display doesn't fit the stream\n";
+        } else {
+            stream.reset(new FrameStreamer(std::move(sink)));
+        }
+    }
+
+    Metrics metrics("main");
+    std::unique_ptr<MetricsExporter> exporter;
+
+    if (metricsTarget) {
+        std::unique_ptr<FrameSink> sink = OpenFrameSink(metricsTarget);
+
+        if (!sink) {
+            std::cerr << "Could not open metrics output " << metricsTarget << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        exporter.reset(new MetricsExporter(std::move(sink), {&metrics}));
+    }
+
+    // One frame of emulation, after waiting for its deadline, with the keypad as it is now.
+    // Returns whether the display changed.
+    auto stepFrame = [&](bool rewinding) {
+        scheduler.WaitForNextFrame();
 
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
-    bool quit = false;
+        auto frameStart = std::chrono::steady_clock::now();
 
-    while (!quit) {
-        quit = platform.ProcessInput(chip8.keypad);
+        // Holding Backspace steps back a frame at a time. A recording can only go forward,
+        // so there's no rewinding while one is being made.
+        if (!recordFilename && rewinding) {
+            // The keypad is whatever is held down now, not what was held back then
+            uint16_t keys = chip8.keys;
+            rewind.Pop(chip8);
+            chip8.keys = keys;
+        } else {
+            // Input only changes between frames, so that's all a recording needs to capture
+            recorder.Record(executed, chip8.keys);
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
+            executed += chip8.RunFrame(scheduler.InstructionsThisFrame());
 
-        if (dt > cycleDelay) {
-            lastCycleTime = currentTime;
+            rewind.Push(chip8);
+        }
+
+        // The sound for the frame just run, while the device plays the last one
+        beeper.Fill(chip8, audio);
+
+        metrics.RecordFrame(executed, chip8.idleCycles, chip8.spritesDrawn, chip8.familyCounts,
+                            scheduler.DroppedFrames(), chip8.dirtyRows != 0, std::chrono::steady_clock::now() - frameStart);
 
-            chip8.Cycle();
+        // Nothing was drawn this frame, so what's on screen is still correct
+        if (!chip8.dirtyRows) {
+            return false;
+        }
+
+        chip8.dirtyRows = 0;
 
-            platform.Update(chip8.video, videoPitch);
+        if (stream) {
+            stream->Push(scheduler.Frames(), chip8.video);
         }
+
+        return true;
+    };
+
+    if (!threaded) {
+        bool quit = false;
+
+        while (!quit) {
+            if (chip8.waitingForKey) {
+                // Blocked on a key: sleep in the event queue until input arrives or the next
+                // frame is due, so the timers keep counting
+                quit = platform.WaitInput(chip8.keys, scheduler.MillisecondsUntilNextFrame());
+            } else {
+                quit = platform.ProcessInput(chip8.keys);
+            }
+
+            if (stepFrame(platform.RewindHeld())) {
+                platform.Update(chip8.Screen());
+            }
+        }
+    } else {
+        /* The emulation thread owns the Chip8 and keeps to its own schedule, whatever the
+         * window is doing. Finished frames go to the window thread through a triple buffer,
+         * so a present that stalls on vsync or the compositor only means frames get skipped
+         * on screen, and input comes back through a queue. SDL wants its events and
+         * rendering on the main thread, so that's the window thread.
+         */
+        SpscQueue<InputMessage, 64> input;
+        TripleBuffer<Frame> frames;
+        std::atomic<bool> quit{false};
+
+        std::thread emulation([&] {
+            bool rewinding = false;
+
+            while (!quit.load(std::memory_order_relaxed)) {
+                InputMessage message;
+
+                while (input.Pop(message)) {
+                    chip8.keys = message.keys;
+                    rewinding = message.rewind;
+                }
+
+                if (stepFrame(rewinding)) {
+                    Chip8::Display screen = chip8.Screen();
+                    Frame& frame = frames.Back();
+
+                    std::copy(screen.rows, screen.rows + screen.Words(), frame.rows);
+                    frame.display = screen;
+                    frame.display.rows = frame.rows;
+                    frames.Publish();
+
+                    Platform::Wake();
+                }
+            }
+        });
+
+        // What the emulation thread was last told, so only changes are sent
+        InputMessage sent{};
+        uint16_t keys = 0;
+
+        while (!quit.load(std::memory_order_relaxed)) {
+            bool closed = platform.WaitInput(keys, WINDOW_WAIT_MS);
+
+            InputMessage current{keys, platform.RewindHeld()};
+
+            // A full queue just means trying again next time round
+            if ((current.keys != sent.keys || current.rewind != sent.rewind) && input.Push(current)) {
+                sent = current;
+            }
+
+            if (frames.Update()) {
+                platform.Update(frames.Front().display);
+            }
+
+            if (closed) {
+                quit.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        emulation.join();
+    }
+
+    std::cerr << "frames " << scheduler.Frames() << " dropped " << scheduler.DroppedFrames()
+              << " jitter mean " << scheduler.MeanJitterMicroseconds() << "us max "
+              << scheduler.MaxJitterMicroseconds() << "us\n";
+
+    if (stream) {
+        std::cerr << "stream dropped " << stream->DroppedFrames() << (stream->Failed() ? " (write failed)" : "") << "\n";
     }
+
+    if (exporter && exporter->Failed()) {
+        std::cerr << "metrics output failed\n";
+    }
+
+    if (recordFilename && !recorder.Save(recordFilename, executed)) {
+        std::cerr << "Could not write input script " << recordFilename << "\n";
+        return EXIT_FAILURE;
+    }
+
     return 0;
 }
@@ -0,0 +1,158 @@
+//
+// Checks that every dispatch engine ends up in exactly the same state when programs store
+// into the code they're running, with I wrapped past the end of memory.
+//
+
+#include "Chip8.h"
+#include "QuirksDatabase.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+const unsigned int TRIALS = 200;
+const unsigned int FRAMES = 60;
+const unsigned int INSTRUCTIONS_PER_FRAME = 13;
+const unsigned int PROGRAM_LENGTH = 120;
+
+const Dispatch ENGINES[] = {Dispatch::Table, Dispatch::Switch, Dispatch::Cached, Dispatch::Recompiler};
+const Quirks PROFILES[] = {Quirks::Modern, Quirks::Cosmac, Quirks::SuperChip, Quirks::XoChip};
+
+static std::vector<std::unique_ptr<Chip8>> Machines(Quirks quirks, uint8_t const* rom, size_t size) {
+    std::vector<std::unique_ptr<Chip8>> machines;
+
+    for (Dispatch dispatch : ENGINES) {
+        machines.emplace_back(new Chip8(dispatch));
+        machines.back()->SetQuirks(quirks);
+        machines.back()->LoadROM(rom, size);
+    }
+
+    return machines;
+}
+
+// True if every machine saves the same state as the first
+static bool Agree(std::vector<std::unique_ptr<Chip8>> const& machines) {
+    std::vector<uint8_t> expected;
+    machines[0]->SaveState(expected);
+
+    for (size_t i = 1; i < machines.size(); ++i) {
+        std::vector<uint8_t> actual;
+        machines[i]->SaveState(actual);
+
+        if (actual != expected) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Stores at I = 0x1000 and up, which the classic profiles wrap back onto the program.
+ * Under Cosmac OP_Fx55 leaves I one past the last byte, so the second store overwrites
+ * the 7101 at 0x200 with 7103 and the next trip round adds 3 to V1 instead of 1.
+ */
+static bool StoreOverProgram() {
+    uint8_t const rom[] = {
+            0x61, 0x01,  // V1 = 1
+            0xAF, 0xFF,  // I = 0xFFF
+            0x60, 0xFF,  // V0 = 0xFF
+            0xF0, 0x1E,  // I = 0x10FE
+            0xF0, 0x1E,  // I = 0x11FD
+            0x60, 0x03,  // V0 = 3
+            0xF0, 0x1E,  // I = 0x1200, where 0x200 is
+            0x60, 0x71,  // V0 = 0x71
+            0xF0, 0x55,  // 0x200 = 0x71, and I moves on to 0x201
+            0x12, 0x00,  // back to the start
+    };
+
+    std::vector<std::unique_ptr<Chip8>> machines = Machines(Quirks::Cosmac, rom, sizeof(rom));
+    bool agree = true;
+
+    for (std::unique_ptr<Chip8>& machine : machines) {
+        machine->RunFor(21);
+        agree = agree && machine->registers[1] == 3;
+    }
+
+    return agree && Agree(machines);
+}
+
+/* Random loops that keep walking I over the end of memory with Fx1E and storing there
+ * with Fx33, Fx55 and 5xy2, so stores land on code that has already been decoded or
+ * compiled, and on ranges that wrap from the last bytes of memory round to the first.
+ * The loops go round and come back to what they stored, which is why a stale entry
+ * shows up as a difference.
+ */
+static std::vector<uint8_t> RandomProgram(std::mt19937& random) {
+    std::vector<uint8_t> program;
+
+    auto emit = [&program](uint16_t instruction) {
+        program.push_back(instruction >> 8u);
+        program.push_back(instruction & 0xFFu);
+    };
+
+    for (unsigned int i = 0; i < PROGRAM_LENGTH; ++i) {
+        uint16_t x = random() % 16;
+        uint16_t y = random() % 16;
+        uint16_t kk = random() % 256;
+
+        switch (random() % 11) {
+            case 0: emit(0x6000u | x << 8u | kk); break;
+            case 1: emit(0x7000u | x << 8u | kk); break;
+            case 2: emit(0xA000u | (0xF00 + random() % 0x100)); break;
+            case 3: emit(0xA000u | (0x200 + 2 * (random() % PROGRAM_LENGTH))); break;
+            case 4: emit(0xF01Eu | x << 8u); break;
+            case 5: emit(0xF033u | x << 8u); break;
+            case 6: emit(0xF055u | (random() % 4) << 8u); break;
+            case 7: emit(0x5002u | x << 8u | y << 4u); break;
+            case 8: emit(0x1000u | (START_ADDRESS + 2 * (random() % PROGRAM_LENGTH))); break;
+            case 9: emit(0x2000u | (START_ADDRESS + 2 * (random() % PROGRAM_LENGTH))); break;
+            // I somewhere in 0x11FD to 0x12FC, which the classic profiles wrap onto the program
+            case 10:
+                emit(0x60FFu | x << 8u);
+                emit(0xA000u | (0xF00 + random() % 0x100));
+                emit(0xF01Eu | x << 8u);
+                emit(0xF01Eu | x << 8u);
+                emit(0xF01Eu | x << 8u);
+                break;
+        }
+    }
+
+    emit(0x1000u | START_ADDRESS);
+
+    return program;
+}
+
+int main() {
+    unsigned int failures = 0;
+
+    if (!StoreOverProgram()) {
+        std::printf("engines differ storing over the program through a wrapped I\n");
+        ++failures;
+    }
+
+    std::mt19937 random(28);
+
+    for (unsigned int trial = 0; trial < TRIALS; ++trial) {
+        std::vector<uint8_t> program = RandomProgram(random);
+        Quirks quirks = PROFILES[trial % 4];
+
+        std::vector<std::unique_ptr<Chip8>> machines = Machines(quirks, program.data(), program.size());
+
+        for (unsigned int frame = 0; frame < FRAMES; ++frame) {
+            for (std::unique_ptr<Chip8>& machine : machines) {
+                machine->RunFrame(INSTRUCTIONS_PER_FRAME);
+            }
+
+            if (!Agree(machines)) {
+                std::printf("trial %u (%s) frame %u: engines differ\n", trial, QuirksName(quirks), frame);
+                ++failures;
+                break;
+            }
+        }
+    }
+
+    std::printf("%u of %u trials differed\n", failures, TRIALS + 1);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+//
+// Checks that every lane of a Chip8Lanes ends up exactly where a Chip8 on its own does.
+//
+
+#include "Chip8.h"
+#include "Chip8Lanes.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+const unsigned int TRIALS = 300;
+const unsigned int FRAMES = 100;
+const unsigned int INSTRUCTIONS_PER_FRAME = 11;
+const unsigned int PROGRAM_LENGTH = 150;
+
+/* Random programs made mostly of the instructions lanes run together, with jumps, calls
+ * and returns thrown in and I pointed anywhere at all: some programs keep to memory and
+ * the stack, and some walk I off the end of memory, call deeper than sixteen levels or
+ * return with nothing on the stack, where lanes have to wrap the same way Chip8 does.
+ */
+static std::vector<uint8_t> RandomProgram(std::mt19937& random) {
+    std::vector<uint8_t> program;
+
+    auto emit = [&program](uint16_t instruction) {
+        program.push_back(instruction >> 8u);
+        program.push_back(instruction & 0xFFu);
+    };
+
+    auto target = [&random] {
+        return static_cast<uint16_t>(START_ADDRESS + 2 * (random() % PROGRAM_LENGTH));
+    };
+
+    emit(0xA800);
+
+    for (unsigned int i = 0; i < PROGRAM_LENGTH; ++i) {
+        uint16_t x = random() % 16;
+        uint16_t y = random() % 16;
+        uint16_t kk = random() % 256;
+
+        switch (random() % 24) {
+            case 0: emit(0x6000u | x << 8u | kk); break;
+            case 1: emit(0x7000u | x << 8u | kk); break;
+            case 2: {
+                uint16_t const operations[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+                emit(0x8000u | x << 8u | y << 4u | operations[random() % 9]);
+            } break;
+            case 3: emit(0xC000u | x << 8u | (random() % 4 ? kk : 1)); break;
+            case 4: emit(0x3000u | x << 8u | kk % 4); break;
+            case 5: emit(0x4000u | x << 8u | kk % 4); break;
+            case 6: emit(0x5000u | x << 8u | y << 4u); break;
+            case 7: emit(0x9000u | x << 8u | y << 4u); break;
+            case 8: emit(0xA000u | (0x800 + random() % 0x600)); break;
+            case 9: emit(0xD000u | x << 8u | y << 4u | random() % 16); break;
+            case 10: emit(0xF033u | x << 8u); break;
+            case 11: emit(0xF055u | x << 8u); break;
+            case 12: emit(0xF065u | x << 8u); break;
+            case 13: emit(0xF029u | x << 8u); break;
+            case 14: emit(0xF015u | x << 8u); break;
+            case 15: emit(0xF007u | x << 8u); break;
+            case 16: emit(random() % 2 ? 0xE09Eu | x << 8u : 0xE0A1u | x << 8u); break;
+            case 17: emit(0xF00Au | x << 8u); break;
+            case 18: emit(0x1000u | target()); break;
+            case 19: emit(0x00E0); break;
+            case 20: emit(0x2000u | target()); break;
+            case 21: emit(0x00EE); break;
+            // Past the end of memory, and further still with Fx1E
+            case 22: emit(0xA000u | (0xFF0 + random() % 0x10)); break;
+            case 23: emit(0xF01Eu | x << 8u); break;
+        }
+    }
+
+    emit(0x1000u | START_ADDRESS);
+
+    return program;
+}
+
+int main() {
+    std::mt19937 random(11);
+    unsigned int failures = 0;
+
+    for (unsigned int trial = 0; trial < TRIALS; ++trial) {
+        std::vector<uint8_t> program = RandomProgram(random);
+        size_t laneCount = 1 + random() % 40;
+
+        Chip8Lanes lanes(laneCount);
+        lanes.LoadROM(program.data(), program.size());
+
+        // Every engine takes a turn as the reference
+        std::vector<std::unique_ptr<Chip8>> machines;
+        Dispatch const engines[] = {Dispatch::Table, Dispatch::Switch, Dispatch::Cached, Dispatch::Recompiler};
+
+        for (size_t lane = 0; lane < laneCount; ++lane) {
+            uint64_t seed = random() % 3 ? 1 : random();
+
+            machines.emplace_back(new Chip8(engines[lane % 4]));
+            machines[lane]->LoadROM(program.data(), program.size());
+            machines[lane]->Seed(seed);
+            lanes.Seed(lane, seed);
+        }
+
+        bool failed = false;
+
+        for (unsigned int frame = 0; frame < FRAMES && !failed; ++frame) {
+            for (size_t lane = 0; lane < laneCount; ++lane) {
+                uint16_t keys = random() % 4 == 0 ? random() & 0xFFFFu : (frame % 7 == 0 ? 0 : 1);
+
+                lanes.SetKeys(lane, keys);
+                machines[lane]->keys = keys;
+            }
+
+            lanes.RunFor(INSTRUCTIONS_PER_FRAME);
+            lanes.TickTimers();
+
+            for (std::unique_ptr<Chip8>& machine : machines) {
+                machine->RunFrame(INSTRUCTIONS_PER_FRAME);
+            }
+
+            for (size_t lane = 0; lane < laneCount && !failed; ++lane) {
+                Chip8 copy;
+                lanes.CopyTo(lane, copy);
+
+                std::vector<uint8_t> expected;
+                std::vector<uint8_t> actual;
+                machines[lane]->SaveState(expected);
+                copy.SaveState(actual);
+
+                if (actual != expected || copy.waitingForKey != machines[lane]->waitingForKey) {
+                    std::printf("trial %u frame %u lane %zu: lane and Chip8 differ\n", trial, frame, lane);
+                    failed = true;
+                }
+            }
+        }
+
+        failures += failed;
+    }
+
+    std::printf("%u of %u trials differed\n", failures, TRIALS);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
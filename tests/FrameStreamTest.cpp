@@ -0,0 +1,230 @@
+//
+// Encodes frames and reads them back: every frame that was sent has to come out as it
+// went in, and truncated or corrupt streams have to be refused without reading or
+// writing outside the data.
+//
+
+#include "DeltaCoding.h"
+#include "FrameStream.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+const unsigned int FRAMES = 500;
+const unsigned int KEYFRAME_INTERVAL = 10;
+
+struct Sent {
+    uint64_t frame;
+    uint64_t video[VIDEO_HEIGHT];
+};
+
+static unsigned int failures = 0;
+
+static void Check(bool ok, char const* what) {
+    if (!ok) {
+        std::printf("%s\n", what);
+        ++failures;
+    }
+}
+
+/* A display that mostly stays put, with a sprite-sized block moving around it now and
+ * then, the odd frame cleared or filled, and frames skipped the way the streamer skips
+ * the ones it had to drop. Returns the stream together with every frame that changed.
+ */
+static std::vector<uint8_t> Stream(std::mt19937& random, std::vector<Sent>& sent) {
+    FrameEncoder encoder(KEYFRAME_INTERVAL);
+    std::vector<uint8_t> stream;
+    uint64_t video[VIDEO_HEIGHT]{};
+
+    encoder.Header(stream);
+
+    for (uint64_t frame = 0; frame < FRAMES; ++frame) {
+        switch (random() % 8) {
+            case 0:
+            case 1:
+                // Nothing changed
+                break;
+            case 2:
+                memset(video, random() % 2 ? 0x00 : 0xFF, sizeof(video));
+                break;
+            case 3:
+                // Dropped before it got to the encoder
+                continue;
+            default: {
+                unsigned int x = random() % (VIDEO_WIDTH - 8);
+                unsigned int y = random() % (VIDEO_HEIGHT - 5);
+
+                for (unsigned int row = y; row < y + 5; ++row) {
+                    video[row] ^= uint64_t(random() & 0xFFu) << x;
+                }
+            } break;
+        }
+
+        size_t before = stream.size();
+        encoder.Encode(frame, video, stream);
+
+        if (stream.size() != before) {
+            sent.push_back(Sent{frame, {}});
+            memcpy(sent.back().video, video, sizeof(video));
+        }
+    }
+
+    return stream;
+}
+
+static void RoundTrip(std::vector<uint8_t> const& stream, std::vector<Sent> const& sent) {
+    FrameDecoder decoder;
+    size_t at = decoder.ReadHeader(stream.data(), stream.size());
+
+    Check(at != 0, "header refused");
+
+    // Where each record starts, for joining the stream part way through below
+    std::vector<size_t> records;
+
+    while (at < stream.size() && records.size() < sent.size()) {
+        size_t used = decoder.ReadRecord(stream.data() + at, stream.size() - at);
+
+        if (!used) {
+            break;
+        }
+
+        Check(decoder.frame == sent[records.size()].frame, "frame number differs");
+        Check(memcmp(decoder.video, sent[records.size()].video, sizeof(decoder.video)) == 0, "frame differs");
+
+        records.push_back(at);
+        at += used;
+    }
+
+    Check(records.size() == sent.size() && at == stream.size(), "records missing or left over");
+
+    /* A viewer joining late skips records up to the next keyframe and picks up from
+     * there. The gap in the first record it reads is counted from frame 0, so its frame
+     * numbers are the stream's less the frame of the record before.
+     */
+    size_t join = 1;
+
+    while (join < records.size() && stream[records[join] + 1] != FrameEncoder::KEYFRAME) {
+        ++join;
+    }
+
+    Check(join < records.size(), "no keyframe after the first");
+
+    FrameDecoder late;
+    at = records[join];
+
+    for (size_t record = join; record < records.size(); ++record) {
+        size_t used = late.ReadRecord(stream.data() + at, stream.size() - at);
+
+        Check(used != 0, "record refused after joining");
+        Check(late.frame == sent[record].frame - sent[join - 1].frame, "frame number differs after joining");
+        Check(memcmp(late.video, sent[record].video, sizeof(late.video)) == 0, "frame differs after joining");
+
+        at += used;
+    }
+}
+
+// Every cut-short header and record is refused, and a refused record leaves the
+// decoder's frame as it was
+static void Truncated(std::vector<uint8_t> const& stream) {
+    FrameDecoder decoder;
+    size_t at = decoder.ReadHeader(stream.data(), stream.size());
+
+    for (size_t size = 0; size < at; ++size) {
+        Check(FrameDecoder().ReadHeader(stream.data(), size) == 0, "short header accepted");
+    }
+
+    for (unsigned int record = 0; record < 4 * KEYFRAME_INTERVAL && at < stream.size(); ++record) {
+        FrameDecoder whole = decoder;
+        size_t used = whole.ReadRecord(stream.data() + at, stream.size() - at);
+
+        for (size_t size = 0; size < used; ++size) {
+            // Copied out, so reading past the cut would be reading past the buffer
+            std::vector<uint8_t> cut(stream.begin() + at, stream.begin() + at + size);
+            FrameDecoder again = decoder;
+
+            Check(again.ReadRecord(cut.data(), cut.size()) == 0, "short record accepted");
+            Check(memcmp(again.video, decoder.video, sizeof(again.video)) == 0, "refused record changed the frame");
+        }
+
+        decoder = whole;
+        at += used;
+    }
+}
+
+// Deltas whose counts run past the frame, including ones big enough to wrap round if
+// they were added up
+static void Corrupt(std::vector<uint8_t> const& stream) {
+    FrameDecoder decoder;
+    size_t at = decoder.ReadHeader(stream.data(), stream.size());
+    at += decoder.ReadRecord(stream.data() + at, stream.size() - at);
+
+    size_t const counts[][2] = {
+            {FrameEncoder::FRAME_BYTES, 1},
+            {0, FrameEncoder::FRAME_BYTES + 1},
+            {SIZE_MAX, 2},
+            {2, SIZE_MAX},
+            {SIZE_MAX - 1, SIZE_MAX - 1},
+    };
+
+    for (auto const& count : counts) {
+        std::vector<uint8_t> payload;
+        PutVarint(payload, count[0]);
+        PutVarint(payload, count[1]);
+        payload.push_back(0xFF);
+        payload.push_back(0xFF);
+
+        std::vector<uint8_t> record;
+        PutVarint(record, 1);
+        record.push_back(FrameEncoder::DELTA);
+        PutVarint(record, payload.size());
+        record.insert(record.end(), payload.begin(), payload.end());
+
+        FrameDecoder copy = decoder;
+        Check(copy.ReadRecord(record.data(), record.size()) == 0, "delta past the frame accepted");
+    }
+
+    // A delta needs a frame to go against
+    std::vector<uint8_t> delta{1, FrameEncoder::DELTA, 0};
+    Check(FrameDecoder().ReadRecord(delta.data(), delta.size()) == 0, "delta before any keyframe accepted");
+
+    // Random damage can decode to anything, but never outside the buffers
+    std::mt19937 random(27);
+
+    for (unsigned int trial = 0; trial < 2000; ++trial) {
+        std::vector<uint8_t> damaged(stream.begin() + at, stream.end());
+
+        for (unsigned int i = 0; i < 4; ++i) {
+            damaged[random() % damaged.size()] = random() & 0xFFu;
+        }
+
+        FrameDecoder copy = decoder;
+        size_t offset = 0;
+
+        while (offset < damaged.size()) {
+            size_t used = copy.ReadRecord(damaged.data() + offset, damaged.size() - offset);
+
+            if (!used) {
+                break;
+            }
+
+            offset += used;
+        }
+    }
+}
+
+int main() {
+    std::mt19937 random(27);
+    std::vector<Sent> sent;
+    std::vector<uint8_t> stream = Stream(random, sent);
+
+    RoundTrip(stream, sent);
+    Truncated(stream);
+    Corrupt(stream);
+
+    std::printf("%u failures over %zu frames sent\n", failures, sent.size());
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
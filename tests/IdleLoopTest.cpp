@@ -0,0 +1,109 @@
+//
+// Checks that skipping idle loops leaves every engine exactly where running them would.
+//
+
+#include "Chip8.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+const Dispatch ENGINES[] = {Dispatch::Table, Dispatch::Switch, Dispatch::Cached, Dispatch::Recompiler};
+char const* const ENGINE_NAMES[] = {"table", "switch", "cached", "recompiler"};
+
+// Batch sizes that stop at every point of a trip round the loops below, and frames long
+// enough to skip hundreds of trips
+const unsigned int BUDGETS[] = {1, 2, 3, 5, 7, 11, 13, 100, 701, 1000, 4096};
+const unsigned int BATCHES = 300;
+
+struct Program {
+    char const* name;
+    std::vector<uint8_t> rom;
+};
+
+const Program PROGRAMS[] = {
+        // Waits for the delay timer, counts in V1 and starts over
+        {"timer poll", {
+                0x6F, 0x05,  // VF = 5
+                0xFF, 0x15,  // delay = VF
+                0xFE, 0x07,  // VE = delay
+                0x3E, 0x00,  // skip if VE == 0
+                0x12, 0x04,  // back to the poll
+                0x71, 0x01,  // V1 += 1
+                0x12, 0x00,
+        }},
+        // Counts in V1 for as long as key 5 is held, and waits for it otherwise
+        {"key poll", {
+                0x60, 0x05,  // V0 = 5
+                0xE0, 0x9E,  // skip if key V0 is down
+                0x12, 0x02,  // back to the poll
+                0x71, 0x01,  // V1 += 1
+                0x12, 0x02,
+        }},
+        // Draws once and then stops for good
+        {"jump to self", {
+                0xA0, 0x50,  // I = the font's 0
+                0xD0, 0x15,  // draw it
+                0x71, 0x01,  // V1 += 1
+                0x12, 0x06,  // jump to itself
+        }},
+};
+
+int main() {
+    unsigned int failures = 0;
+
+    for (Program const& program : PROGRAMS) {
+        for (unsigned int engine = 0; engine < 4; ++engine) {
+            Chip8 skipping(ENGINES[engine]);
+            Chip8 running(ENGINES[engine]);
+            running.skipIdleLoops = false;
+
+            skipping.LoadROM(program.rom.data(), program.rom.size());
+            running.LoadROM(program.rom.data(), program.rom.size());
+
+            bool failed = false;
+
+            for (unsigned int batch = 0; batch < BATCHES && !failed; ++batch) {
+                unsigned int budget = BUDGETS[batch % (sizeof(BUDGETS) / sizeof(BUDGETS[0]))];
+
+                // Key 5 goes down and up every few batches
+                uint16_t keys = (batch / 7) % 2 ? 1u << 5u : 0;
+                skipping.keys = keys;
+                running.keys = keys;
+
+                unsigned int skippingRan = skipping.RunFor(budget);
+                unsigned int runningRan = running.RunFor(budget);
+
+                // Some batches end between timer ticks and some right after one
+                if (batch % 3 != 0) {
+                    skipping.TickTimers();
+                    running.TickTimers();
+                }
+
+                std::vector<uint8_t> expected;
+                std::vector<uint8_t> actual;
+                running.SaveState(expected);
+                skipping.SaveState(actual);
+
+                if (actual != expected || skippingRan != runningRan
+                    || skipping.waitingForKey != running.waitingForKey) {
+                    std::printf("%s on %s, batch %u of %u: skipping idle loops changed the outcome\n",
+                                program.name, ENGINE_NAMES[engine], batch, budget);
+                    failed = true;
+                }
+            }
+
+            // Otherwise there's nothing to say the skipping was tested at all
+            if (!failed && (skipping.idleCycles == 0 || running.idleCycles != 0)) {
+                std::printf("%s on %s: %llu instructions skipped, expected some\n", program.name,
+                            ENGINE_NAMES[engine], static_cast<unsigned long long>(skipping.idleCycles));
+                failed = true;
+            }
+
+            failures += failed;
+        }
+    }
+
+    std::printf("%u of %zu runs differed\n", failures, 4 * sizeof(PROGRAMS) / sizeof(PROGRAMS[0]));
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
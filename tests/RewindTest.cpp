@@ -0,0 +1,198 @@
+//
+// Checks that stepping back brings back every frame that was pushed, across keyframes and
+// after the ring has dropped old ones, and that the deltas underneath decode to what was
+// encoded.
+//
+
+#include "Chip8.h"
+#include "DeltaCoding.h"
+#include "Rewind.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+const unsigned int KEYFRAME_INTERVAL = 4;
+const unsigned int INSTRUCTIONS_PER_FRAME = 20;
+const unsigned int PROGRAM_LENGTH = 100;
+
+static unsigned int failures = 0;
+
+static void Check(bool ok, char const* what) {
+    if (!ok) {
+        std::printf("%s\n", what);
+        ++failures;
+    }
+}
+
+static std::vector<uint8_t> Save(Chip8 const& chip8) {
+    std::vector<uint8_t> state;
+    chip8.SaveState(state);
+
+    return state;
+}
+
+// Changes registers, timers, memory and the display a little every frame, like a game would
+static std::vector<uint8_t> RandomProgram(std::mt19937& random) {
+    std::vector<uint8_t> program;
+
+    auto emit = [&program](uint16_t instruction) {
+        program.push_back(instruction >> 8u);
+        program.push_back(instruction & 0xFFu);
+    };
+
+    for (unsigned int i = 0; i < PROGRAM_LENGTH; ++i) {
+        uint16_t x = random() % 16;
+        uint16_t y = random() % 16;
+
+        switch (random() % 6) {
+            case 0: emit(0xC000u | x << 8u | random() % 256); break;
+            case 1: emit(0x7000u | x << 8u | random() % 256); break;
+            case 2: emit(0xA000u | (0x400 + random() % 0x400)); break;
+            case 3: emit(0xD000u | x << 8u | y << 4u | random() % 16); break;
+            case 4: emit(0xF033u | x << 8u); break;
+            case 5: emit(0xF015u | x << 8u); break;
+        }
+    }
+
+    emit(0x1000u | START_ADDRESS);
+
+    return program;
+}
+
+/* Pushes and pops at random, with more pushes than pops so history keeps growing, and
+ * follows along with a plain stack of whole states. Every pop has to give the state on
+ * top of that stack. The ring only ever drops the oldest frames, so once it has the stack
+ * is cut down to the newest Frames() states to match.
+ */
+static void History(size_t capacity, bool fills, std::mt19937& random, char const* name) {
+    std::vector<uint8_t> program = RandomProgram(random);
+
+    Chip8 chip8;
+    chip8.LoadROM(program.data(), program.size());
+    chip8.Seed(random());
+
+    Rewind rewind(capacity, KEYFRAME_INTERVAL);
+    std::vector<std::vector<uint8_t>> expected;
+    bool evicted = false;
+
+    for (unsigned int step = 0; step < 2000; ++step) {
+        if (random() % 3) {
+            chip8.RunFrame(INSTRUCTIONS_PER_FRAME);
+            chip8.TickTimers();
+
+            rewind.Push(chip8);
+            expected.push_back(Save(chip8));
+        } else {
+            bool popped = rewind.Pop(chip8);
+
+            Check(popped == !expected.empty(), "pop didn't match what was pushed");
+
+            if (popped) {
+                Check(Save(chip8) == expected.back(), "popped a different state");
+                expected.pop_back();
+            }
+        }
+
+        Check(rewind.Frames() <= expected.size(), "more frames held than were pushed");
+
+        if (rewind.Frames() < expected.size()) {
+            expected.erase(expected.begin(), expected.end() - rewind.Frames());
+            evicted = true;
+        }
+
+        Check(rewind.BytesUsed() <= capacity, "more bytes held than the ring has");
+    }
+
+    // Then all the way back, past however many keyframes are left
+    while (!expected.empty()) {
+        Check(rewind.Pop(chip8), "history ran out early");
+        Check(Save(chip8) == expected.back(), "popped a different state unwinding");
+        expected.pop_back();
+    }
+
+    Check(!rewind.Pop(chip8) && rewind.Frames() == 0, "popped past the start of history");
+
+    if (evicted != fills) {
+        std::printf("%s: frames %s dropped\n", name, evicted ? "were" : "weren't");
+        ++failures;
+    }
+}
+
+static void Varints(std::mt19937& random) {
+    std::vector<size_t> values{0, 1, 127, 128, 16383, 16384, SIZE_MAX - 1, SIZE_MAX};
+
+    for (unsigned int i = 0; i < 1000; ++i) {
+        values.push_back(size_t(random()) << (random() % 40));
+    }
+
+    std::vector<uint8_t> out;
+
+    for (size_t value : values) {
+        PutVarint(out, value);
+    }
+
+    uint8_t const* in = out.data();
+
+    for (size_t value : values) {
+        Check(GetVarint(in) == value, "varint read back differs");
+    }
+
+    Check(in == out.data() + out.size(), "varints read back a different length");
+}
+
+// Blobs that differ nowhere, everywhere, at either end and in scattered runs
+static void Deltas(std::mt19937& random) {
+    for (unsigned int trial = 0; trial < 500; ++trial) {
+        size_t size = trial % 50 == 0 ? 0 : random() % 5000;
+        std::vector<uint8_t> base(size);
+        std::vector<uint8_t> current(size);
+
+        for (uint8_t& byte : base) {
+            byte = random() & 0xFFu;
+        }
+
+        current = base;
+        unsigned int changes = trial % 5 == 0 ? size : random() % 20;
+
+        for (unsigned int i = 0; i < changes && size; ++i) {
+            current[trial % 5 == 0 ? i : random() % size] ^= 1u + random() % 255;
+        }
+
+        if (trial % 7 == 0 && size) {
+            current.front() ^= 0xFFu;
+            current.back() ^= 0xFFu;
+        }
+
+        std::vector<uint8_t> delta;
+        EncodeDelta(base.data(), current.data(), size, delta);
+
+        if (base == current) {
+            Check(delta.empty(), "delta of identical blobs isn't empty");
+        }
+
+        DecodeDelta(delta.data(), delta.size(), base.data());
+        Check(base == current, "delta decoded to a different blob");
+    }
+}
+
+int main() {
+    std::mt19937 random(18);
+
+    size_t keyframe = Save(Chip8()).size();
+
+    // Room for every frame, so all of history comes back
+    History(2000 * keyframe, false, random, "unbounded");
+    // Room for a couple of keyframes and their deltas, so dropping happens all the time
+    History(3 * keyframe, true, random, "three keyframes");
+    // Barely more than one keyframe, where storing a delta can push out its own keyframe
+    History(keyframe + keyframe / 4, true, random, "one keyframe");
+
+    Varints(random);
+    Deltas(random);
+
+    std::printf("%u failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
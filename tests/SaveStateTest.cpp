@@ -0,0 +1,182 @@
+//
+// Checks that a save state brings back the whole machine under every quirks profile, and
+// that LoadState() refuses anything that isn't a whole state and leaves the machine alone.
+//
+
+#include "Chip8.h"
+#include "QuirksDatabase.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+const unsigned int FRAMES = 30;
+const unsigned int INSTRUCTIONS_PER_FRAME = 20;
+const unsigned int PROGRAM_LENGTH = 200;
+
+const Quirks PROFILES[] = {Quirks::Modern, Quirks::Cosmac, Quirks::SuperChip, Quirks::XoChip};
+
+static unsigned int failures = 0;
+
+static void Check(bool ok, Quirks quirks, char const* what) {
+    if (!ok) {
+        std::printf("%s: %s\n", QuirksName(quirks), what);
+        ++failures;
+    }
+}
+
+/* A program that gets as much of the state as it can away from where Reset() left it:
+ * registers, memory and the stack, the timers, the random number generator and the
+ * display, and for the extended profiles hires mode, the flag registers, the planes and
+ * the audio pattern and pitch.
+ */
+static std::vector<uint8_t> RandomProgram(std::mt19937& random, Quirks quirks) {
+    std::vector<uint8_t> program;
+
+    auto emit = [&program](uint16_t instruction) {
+        program.push_back(instruction >> 8u);
+        program.push_back(instruction & 0xFFu);
+    };
+
+    bool extended = quirks == Quirks::SuperChip || quirks == Quirks::XoChip;
+
+    for (unsigned int i = 0; i < PROGRAM_LENGTH; ++i) {
+        uint16_t x = random() % 16;
+        uint16_t y = random() % 16;
+        uint16_t kk = random() % 256;
+
+        switch (random() % (extended ? 16 : 10)) {
+            case 0: emit(0x6000u | x << 8u | kk); break;
+            case 1: emit(0x7000u | x << 8u | kk); break;
+            case 2: emit(0xC000u | x << 8u | kk); break;
+            case 3: emit(0xA000u | (0x400 + random() % 0x400)); break;
+            case 4: emit(0xD000u | x << 8u | y << 4u | random() % 16); break;
+            case 5: emit(0xF033u | x << 8u); break;
+            case 6: emit(0xF055u | x << 8u); break;
+            case 7: emit(random() % 2 ? 0xF015u | x << 8u : 0xF018u | x << 8u); break;
+            case 8: emit(0x2000u | (START_ADDRESS + 2 * (PROGRAM_LENGTH + 1))); break;
+            case 9: emit(0xF029u | x << 8u); break;
+            case 10: emit(random() % 2 ? 0x00FF : 0x00FE); break;
+            case 11: emit(0x00C0u | random() % 16); break;
+            case 12: emit(0xF075u | (x % 8) << 8u); break;
+            case 13: emit(0xF030u | x << 8u); break;
+            case 14: emit(quirks == Quirks::XoChip ? 0xF001u | (random() % 4) << 8u : 0x00FB); break;
+            case 15: emit(quirks != Quirks::XoChip ? 0x00FC : random() % 2 ? 0xF002 : 0xF03Au | x << 8u); break;
+        }
+    }
+
+    emit(0x1000u | START_ADDRESS);
+
+    // A subroutine that never returns, so the stack keeps growing (and wraps)
+    emit(0x00E0);
+    emit(0x1000u | START_ADDRESS);
+
+    return program;
+}
+
+static std::vector<uint8_t> Save(Chip8 const& chip8) {
+    std::vector<uint8_t> state;
+    chip8.SaveState(state);
+
+    return state;
+}
+
+static void RoundTrip(Quirks quirks, std::mt19937& random) {
+    std::vector<uint8_t> program = RandomProgram(random, quirks);
+
+    Chip8 original;
+    original.SetQuirks(quirks);
+    original.LoadROM(program.data(), program.size());
+    original.Seed(random());
+
+    for (unsigned int frame = 0; frame < FRAMES; ++frame) {
+        original.keys = random() & 0xFFFFu;
+        original.RunFrame(INSTRUCTIONS_PER_FRAME);
+    }
+
+    std::vector<uint8_t> state = Save(original);
+
+    // Loading switches profile, so start from a different one
+    Chip8 restored;
+    restored.SetQuirks(quirks == Quirks::XoChip ? Quirks::Modern : Quirks::XoChip);
+
+    Check(restored.LoadState(state.data(), state.size()), quirks, "state refused");
+    Check(restored.GetQuirks() == quirks, quirks, "profile not restored");
+    Check(Save(restored) == state, quirks, "saving again gives a different state");
+
+    // Whatever isn't in the state would show up as the two going different ways
+    for (unsigned int frame = 0; frame < FRAMES; ++frame) {
+        uint16_t keys = random() & 0xFFFFu;
+        original.keys = keys;
+        restored.keys = keys;
+
+        original.RunFrame(INSTRUCTIONS_PER_FRAME);
+        restored.RunFrame(INSTRUCTIONS_PER_FRAME);
+    }
+
+    Check(Save(restored) == Save(original), quirks, "restored machine ran differently");
+}
+
+// Every way of being wrong is refused, and a refused state changes nothing
+static void Rejected(Quirks quirks) {
+    Chip8 source;
+    source.SetQuirks(quirks);
+    source.RunFor(100);
+
+    std::vector<uint8_t> const state = Save(source);
+
+    Chip8 target;
+    target.SetQuirks(quirks == Quirks::XoChip ? Quirks::Modern : Quirks::XoChip);
+    target.Seed(7);
+    target.RunFor(100);
+
+    std::vector<uint8_t> const before = Save(target);
+
+    auto refused = [&](std::vector<uint8_t> const& bad, char const* what) {
+        Check(!target.LoadState(bad.data(), bad.size()), quirks, what);
+        Check(Save(target) == before, quirks, "refused state changed the machine");
+    };
+
+    std::vector<uint8_t> bad = state;
+    bad[0] ^= 0xFFu;
+    refused(bad, "bad magic accepted");
+
+    bad = state;
+    ++bad[4];
+    refused(bad, "bad version accepted");
+
+    bad = state;
+    bad[5] = static_cast<uint8_t>(Quirks::XoChip) + 1;
+    refused(bad, "unknown profile accepted");
+
+    // Claiming a profile whose state is a different size
+    bad = state;
+    bad[5] = static_cast<uint8_t>(quirks == Quirks::SuperChip ? Quirks::XoChip : Quirks::SuperChip);
+    refused(bad, "state of the wrong size for its profile accepted");
+
+    for (size_t size = 0; size < state.size(); size += size < 64 ? 1 : 61) {
+        refused(std::vector<uint8_t>(state.begin(), state.begin() + size), "short state accepted");
+    }
+
+    refused(std::vector<uint8_t>(state.begin(), state.end() - 1), "state one byte short accepted");
+
+    bad = state;
+    bad.push_back(0);
+    refused(bad, "state with a byte over accepted");
+}
+
+int main() {
+    std::mt19937 random(9);
+
+    for (Quirks quirks : PROFILES) {
+        for (unsigned int trial = 0; trial < 20; ++trial) {
+            RoundTrip(quirks, random);
+        }
+
+        Rejected(quirks);
+    }
+
+    std::printf("%u failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}